@@ -0,0 +1,131 @@
+#pragma once
+#include <assert.h>
+#include <utility>
+#include <vector>
+
+#include "constants.h"
+#include "free_list.h"
+#include "game_state.h"
+
+typedef unsigned int tArmyHandle;
+
+/// Hands out stable 32-bit generational handles for armies stored in a dense
+/// array. Systems keep iterating the dense array; the pool follows every move
+/// of an army inside it, so a handle keeps resolving to the same army until
+/// that army is destroyed. Slots are recycled through a FreeList.
+class ArmyPool
+{
+public:
+	// 0-19 Slot
+	// 20-31 Generation
+	static constexpr int slotBits = 20;
+	static constexpr unsigned int slotMask = (1u << slotBits) - 1;
+	static constexpr unsigned int generationMask = (1u << (32 - slotBits)) - 1;
+	static constexpr tArmyHandle invalidHandle = 0xFFFFFFFF;
+
+	ArmyPool()
+	{
+		handles.resize(Constants::maxArmies, invalidHandle);
+	}
+
+	/// Drops all handles and creates new ones for dense indices [0, count).
+	void Reset(int count)
+	{
+		slots.clear();
+		generations.clear();
+		std::fill(handles.begin(), handles.end(), invalidHandle);
+
+		for (tArmyIndex i = 0; i < count; ++i)
+			Create(i);
+	}
+
+	/// Creates a handle for the army living at denseIndex.
+	tArmyHandle Create(tArmyIndex denseIndex)
+	{
+		assert(handles[denseIndex] == invalidHandle);
+
+		const int slot = slots.insert(denseIndex);
+		if (slot == (int)generations.size())
+			generations.push_back(0);
+
+		const tArmyHandle handle = MakeHandle(slot, generations[slot]);
+		handles[denseIndex] = handle;
+		return handle;
+	}
+
+	/// Invalidates the handle. Destroying a stale handle does nothing.
+	void Destroy(tArmyHandle handle)
+	{
+		if (!IsAlive(handle))
+			return;
+
+		const int slot = GetSlot(handle);
+		handles[slots[slot]] = invalidHandle;
+		generations[slot] = (generations[slot] + 1) & generationMask;
+		slots.erase(slot);
+	}
+
+	/// Records that armies at dense indices a and b swapped places.
+	void Swap(tArmyIndex a, tArmyIndex b)
+	{
+		std::swap(handles[a], handles[b]);
+
+		if (handles[a] != invalidHandle)
+			slots[GetSlot(handles[a])] = a;
+		if (handles[b] != invalidHandle)
+			slots[GetSlot(handles[b])] = b;
+	}
+
+	bool IsAlive(tArmyHandle handle) const
+	{
+		if (handle == invalidHandle)
+			return false;
+
+		const int slot = GetSlot(handle);
+		return slot < (int)generations.size() && generations[slot] == GetGeneration(handle);
+	}
+
+	/// Returns the current dense index of the army, or -1 when the handle is stale.
+	tArmyIndex Resolve(tArmyHandle handle) const
+	{
+		return IsAlive(handle) ? slots[GetSlot(handle)] : -1;
+	}
+
+	tArmyHandle GetHandle(tArmyIndex denseIndex) const
+	{
+		return handles[denseIndex];
+	}
+
+	size_t GetMemoryBytes() const
+	{
+		return slots.memory() + generations.capacity() * sizeof(unsigned short) + handles.capacity() * sizeof(tArmyHandle);
+	}
+
+	/// Dense index -> handle, parallel to the armies array.
+	const std::vector<tArmyHandle>& GetHandles() const
+	{
+		return handles;
+	}
+
+private:
+	static tArmyHandle MakeHandle(int slot, unsigned int generation)
+	{
+		return (generation << slotBits) | (unsigned int)slot;
+	}
+
+	static int GetSlot(tArmyHandle handle)
+	{
+		return (int)(handle & slotMask);
+	}
+
+	static unsigned int GetGeneration(tArmyHandle handle)
+	{
+		return handle >> slotBits;
+	}
+
+	FreeList<tArmyIndex> slots;
+	std::vector<unsigned short> generations;
+	std::vector<tArmyHandle> handles;
+};
+
+static_assert(Constants::maxArmies <= (int)ArmyPool::slotMask);
@@ -15,6 +15,7 @@ struct Constants
 	static const int armySpeed = 270;
 	static const int countrySpeed = 1570;
 
+	// Default country count; --countries raises it up to Army::maxCountryCount.
 	static const int maxCountries = 15;
 	static const int maxArmies = 1000000;
 
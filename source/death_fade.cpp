@@ -0,0 +1,156 @@
+#include "death_fade.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "optick.h"
+#include "parallel_for.h"
+#include "raylib_extensions.h"
+
+
+DeathFade::DeathFade()
+{
+	bandStart.resize(bandCount + 1);
+	bandIndices.resize((bandCount + 1) / 2);
+	std::iota(bandIndices.begin(), bandIndices.end(), 0);
+}
+
+void DeathFade::Spawn(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	const int batchSize = 65535;
+	const int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
+	if ((int)batchSpawns.size() < batchCount)
+		batchSpawns.resize(batchCount);
+
+	splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+		{
+			std::vector<Particle>& spawns = batchSpawns[batchIndex];
+			spawns.clear();
+			for (int i : range)
+			{
+				if (armies[i].getHitPoints() != 0)
+					continue;
+
+				const ShallowTest::Vector2 position = armies[i].getPosition();
+				const int x = std::clamp((int)position.x, 0, Constants::screenWidth - 1);
+				const int y = std::clamp((int)position.y, 0, Constants::screenHeight - 1);
+				spawns.push_back({ (uint16_t)x, (uint16_t)y, (uint8_t)fadeFrames });
+			}
+		});
+
+	for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+		particles.insert(particles.end(), batchSpawns[batchIndex].begin(), batchSpawns[batchIndex].end());
+}
+
+void DeathFade::Draw(std::vector<Color>& pixels)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	compact();
+	if (particles.empty())
+		return;
+
+	// Even bands, then odd bands.
+	for (int phase = 0; phase < 2; ++phase)
+	{
+		parallelFor(bandIndices, [&](int i)
+			{
+				const int band = 2 * i + phase;
+				if (band < bandCount)
+					drawBand(band, pixels);
+			});
+	}
+}
+
+size_t DeathFade::GetMemoryBytes() const
+{
+	size_t bytes = (particles.capacity() + sorted.capacity()) * sizeof(Particle)
+		+ (chunkOffsets.capacity() + bandStart.capacity() + bandIndices.capacity()) * sizeof(int);
+	for (const std::vector<Particle>& spawns : batchSpawns)
+		bytes += spawns.capacity() * sizeof(Particle);
+	return bytes;
+}
+
+void DeathFade::compact()
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	const int particleCount = (int)particles.size();
+	if (particleCount == 0)
+	{
+		std::fill(bandStart.begin(), bandStart.end(), 0);
+		return;
+	}
+
+	// Counting sort of the live particles by band: count per chunk, offsets, scatter.
+	ThreadPool& pool = ThreadPool::Get();
+	const int chunkCount = std::min(particleCount, pool.GetThreadCount() * 4);
+	chunkOffsets.assign((size_t)chunkCount * bandCount, 0);
+
+	auto forChunk = [&](int chunk, auto&& callback)
+	{
+		const int begin = (int)((long long)particleCount * chunk / chunkCount);
+		const int end = (int)((long long)particleCount * (chunk + 1) / chunkCount);
+		for (int i = begin; i < end; ++i)
+		{
+			if (particles[i].life > 0)
+				callback(particles[i]);
+		}
+	};
+
+	pool.Run(chunkCount, [&](int chunk)
+		{
+			int* counts = chunkOffsets.data() + (size_t)chunk * bandCount;
+			forChunk(chunk, [&](const Particle& particle) { ++counts[particle.y / bandHeight]; });
+		});
+
+	int liveCount = 0;
+	for (int band = 0; band < bandCount; ++band)
+	{
+		bandStart[band] = liveCount;
+		for (int chunk = 0; chunk < chunkCount; ++chunk)
+		{
+			int& offset = chunkOffsets[(size_t)chunk * bandCount + band];
+			const int count = offset;
+			offset = liveCount;
+			liveCount += count;
+		}
+	}
+	bandStart[bandCount] = liveCount;
+	sorted.resize(liveCount);
+
+	pool.Run(chunkCount, [&](int chunk)
+		{
+			int* offsets = chunkOffsets.data() + (size_t)chunk * bandCount;
+			forChunk(chunk, [&](const Particle& particle) { sorted[offsets[particle.y / bandHeight]++] = particle; });
+		});
+
+	particles.swap(sorted);
+}
+
+void DeathFade::drawBand(int band, std::vector<Color>& pixels)
+{
+	const int pixelCount = Constants::screenWidth * Constants::screenHeight;
+	for (int i = bandStart[band]; i < bandStart[band + 1]; ++i)
+	{
+		Particle& particle = particles[i];
+
+		Color c = BLACK;
+		c.r = (unsigned char)(255 * particle.life / fadeFrames);
+
+		const int pixelIndex = particle.y * Constants::screenWidth + particle.x;
+		pixels[pixelIndex] += c;
+		if (pixelIndex + 1 < pixelCount)
+			pixels[pixelIndex + 1] += c;
+		if (pixelIndex > 0)
+			pixels[pixelIndex - 1] += c;
+		if (pixelIndex + Constants::screenWidth < pixelCount)
+			pixels[pixelIndex + Constants::screenWidth] += c;
+		if (pixelIndex - Constants::screenWidth >= 0)
+			pixels[pixelIndex - Constants::screenWidth] += c;
+
+		--particle.life;
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "constants.h"
+#include "game_state.h"
+#include "raylib.h"
+
+
+/// Red glow left where an army died, fading out over a few frames. Live
+/// particles are kept in an active list instead of a screen sized buffer, so
+/// the cost per frame follows the number of recent deaths, not the resolution.
+/// Each frame the list is compacted and sorted into row bands in parallel;
+/// bands are then drawn in parallel, even bands before odd ones, so
+/// neighbouring bands never write the same pixel at the same time.
+class DeathFade
+{
+public:
+	static const int fadeFrames = 15;
+
+	DeathFade();
+
+	/// Starts a particle at every army whose hit points reached zero.
+	void Spawn(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies);
+
+	/// Drops finished particles, adds the rest to the screen sized pixel buffer
+	/// and ages them by one frame.
+	void Draw(std::vector<Color>& pixels);
+
+	int GetParticleCount() const { return (int)particles.size(); }
+	size_t GetMemoryBytes() const;
+
+private:
+	// A particle's glow reaches one row above and below it, so bands of at
+	// least three rows drawn two phases apart never overlap.
+	static const int bandHeight = 16;
+	static const int bandCount = (Constants::screenHeight + bandHeight - 1) / bandHeight;
+	static_assert(bandHeight >= 3);
+
+	struct Particle
+	{
+		uint16_t x;
+		uint16_t y;
+		uint8_t life;
+	};
+
+	void compact();
+	void drawBand(int band, std::vector<Color>& pixels);
+
+	std::vector<Particle> particles;
+	std::vector<Particle> sorted;
+	std::vector<std::vector<Particle>> batchSpawns;
+	// Survivors per chunk and band, turned into write offsets.
+	std::vector<int> chunkOffsets;
+	std::vector<int> bandStart;
+	std::vector<int> bandIndices;
+};
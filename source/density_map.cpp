@@ -0,0 +1,156 @@
+#include "density_map.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <numeric>
+
+#include "constants.h"
+#include "optick.h"
+#include "parallel_for.h"
+
+
+namespace
+{
+	// Tile ranges the batch histograms are summed over.
+	const int reduceRangeCount = 64;
+
+	// Memory for the private histograms, which are kept across frames. A 2 px
+	// tile histogram of the screen is about 8 MB, so with many threads small
+	// tiles get fewer histograms than there are threads.
+	const size_t histogramBudgetInBytes = 64 << 20;
+
+	// Log tone map: dim country color for a few armies, full color in the middle,
+	// fading towards white in the densest tiles.
+	Color toneMap(uint32_t count, uint32_t r, uint32_t g, uint32_t b, float invLogMaxCount)
+	{
+		if (count == 0)
+			return BLACK;
+
+		const float value = std::log1p((float)count) * invLogMaxCount;
+		const float scale = std::min(1.0f, 2.0f * value) / (float)count;
+		const float highlight = std::max(0.0f, 2.0f * value - 1.0f);
+		const float white = 0.75f * highlight * highlight;
+
+		auto channel = [&](uint32_t sum)
+		{
+			const float c = (float)sum * scale;
+			return (unsigned char)std::clamp(c + (255.0f - c) * white, 0.0f, 255.0f);
+		};
+
+		return { channel(r), channel(g), channel(b), 255 };
+	}
+}
+
+DensityMap::DensityMap(int tileSize)
+	: tileSize(std::max(1, tileSize))
+	, width((Constants::screenWidth + this->tileSize - 1) / this->tileSize)
+	, height((Constants::screenHeight + this->tileSize - 1) / this->tileSize)
+{
+	tiles.resize(width * height);
+
+	rowIndices.resize(Constants::screenHeight);
+	std::iota(rowIndices.begin(), rowIndices.end(), 0);
+
+	tileRangeIndices.resize(reduceRangeCount);
+	std::iota(tileRangeIndices.begin(), tileRangeIndices.end(), 0);
+	rangeMaxCounts.resize(reduceRangeCount);
+}
+
+void DensityMap::Accumulate(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies, const std::vector<Color>& countryColors)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	const int tileCount = width * height;
+	if (armyIndices.empty())
+	{
+		std::fill(tiles.begin(), tiles.end(), Tile{});
+		maxCount = 0;
+		return;
+	}
+
+	// At most one batch per thread, and no more than fit the histogram budget,
+	// which bounds both the private histograms' memory and the reduce cost.
+	const size_t histogramBytes = (size_t)tileCount * sizeof(Tile);
+	const int histogramCount = (int)std::clamp<size_t>(histogramBudgetInBytes / histogramBytes, 1, (size_t)ThreadPool::Get().GetThreadCount());
+	const int batchSize = std::max(1, (int)((armyIndices.size() + histogramCount - 1) / histogramCount));
+	const int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
+	if ((int)batchTiles.size() < batchCount)
+		batchTiles.resize(batchCount);
+
+	{
+		OPTICK_EVENT("Histogram");
+		splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+			{
+				std::vector<Tile>& local = batchTiles[batchIndex];
+				local.assign(tileCount, Tile{});
+
+				for (int i : range)
+				{
+					const ShallowTest::Vector2 position = armies[i].getPosition();
+					const int tileIndex = ((int)position.y / tileSize) * width + (int)position.x / tileSize;
+					assert(tileIndex >= 0 && tileIndex < tileCount);
+
+					const Color c = countryColors[armies[i].getCountryIndex()];
+					Tile& tile = local[tileIndex];
+					++tile.count;
+					tile.r += c.r;
+					tile.g += c.g;
+					tile.b += c.b;
+				}
+			});
+	}
+
+	{
+		OPTICK_EVENT("Reduce");
+		parallelFor(tileRangeIndices, [&](int rangeIndex)
+			{
+				const int begin = (int)((long long)tileCount * rangeIndex / reduceRangeCount);
+				const int end = (int)((long long)tileCount * (rangeIndex + 1) / reduceRangeCount);
+
+				std::copy(batchTiles[0].begin() + begin, batchTiles[0].begin() + end, tiles.begin() + begin);
+				for (int batchIndex = 1; batchIndex < batchCount; ++batchIndex)
+				{
+					const Tile* local = batchTiles[batchIndex].data();
+					for (int t = begin; t < end; ++t)
+					{
+						tiles[t].count += local[t].count;
+						tiles[t].r += local[t].r;
+						tiles[t].g += local[t].g;
+						tiles[t].b += local[t].b;
+					}
+				}
+
+				uint32_t rangeMax = 0;
+				for (int t = begin; t < end; ++t)
+					rangeMax = std::max(rangeMax, tiles[t].count);
+				rangeMaxCounts[rangeIndex] = rangeMax;
+			});
+
+		maxCount = *std::max_element(rangeMaxCounts.begin(), rangeMaxCounts.end());
+	}
+}
+
+void DensityMap::Resolve(std::vector<Color>& pixels) const
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	assert(pixels.size() >= Constants::screenWidth * Constants::screenHeight);
+	const float invLogMaxCount = maxCount > 0 ? 1.0f / std::log1p((float)maxCount) : 0.0f;
+
+	parallelFor(rowIndices, [&](int y)
+		{
+			const Tile* tileRow = tiles.data() + (y / tileSize) * width;
+			Color* pixelRow = pixels.data() + y * Constants::screenWidth;
+
+			for (int tileX = 0; tileX < width; ++tileX)
+			{
+				const Tile& tile = tileRow[tileX];
+				const Color c = toneMap(tile.count, tile.r, tile.g, tile.b, invLogMaxCount);
+
+				const int begin = tileX * tileSize;
+				const int end = std::min((int)Constants::screenWidth, begin + tileSize);
+				std::fill(pixelRow + begin, pixelRow + end, c);
+			}
+		});
+}
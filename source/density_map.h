@@ -0,0 +1,50 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "game_state.h"
+#include "raylib.h"
+
+
+/// Alternate army render mode: instead of plotting every army, armies are
+/// binned into screen tiles and each tile is colored by the mix of country
+/// colors in it, with brightness tone mapped from the army count.
+/// Accumulation is one increment per army; resolving costs one pass over the
+/// screen, independent of the army count.
+class DensityMap
+{
+public:
+	explicit DensityMap(int tileSize);
+
+	int GetTileSize() const { return tileSize; }
+
+	/// Parallel histogram: every batch fills a private set of tiles, which are
+	/// then summed tile range by tile range, so no atomics are needed. There are
+	/// at most as many batches as threads, fewer for small tiles, so the private
+	/// histograms stay within a fixed memory budget.
+	void Accumulate(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies, const std::vector<Color>& countryColors);
+
+	/// Tone maps the tiles into a screen sized pixel buffer.
+	void Resolve(std::vector<Color>& pixels) const;
+
+private:
+	// Color channels are sums over all armies in the tile, divided by count on resolve.
+	struct Tile
+	{
+		uint32_t count;
+		uint32_t r;
+		uint32_t g;
+		uint32_t b;
+	};
+
+	int tileSize;
+	int width;
+	int height;
+
+	std::vector<std::vector<Tile>> batchTiles;
+	std::vector<Tile> tiles;
+	std::vector<int> rowIndices;
+	std::vector<int> tileRangeIndices;
+	std::vector<uint32_t> rangeMaxCounts;
+	uint32_t maxCount = 0;
+};
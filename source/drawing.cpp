@@ -9,10 +9,15 @@
 #include <thread>
 
 #include "constants.h"
+#include "death_fade.h"
+#include "density_map.h"
+#include "grid.h"
+#include "memory_report.h"
 #include "optick.h"
 #include "parallel_for.h"
 #include "raylib.h"
 #include "raylib_extensions.h"
+#include "sprite_renderer.h"
 
 
 using Opt = DrawingContext::Options;
@@ -35,32 +40,52 @@ operator&(E lhs, E rhs) {
         static_cast<underlying>(lhs) & static_cast<underlying>(rhs));
 }
 
+void publishDrawingStats(const DrawingContext& context)
+{
+    if (context.spritesDrawn)
+    {
+        Metrics::Set("Sprites.Pixels", context.spritePixels);
+        Metrics::Set("Sprites.HalfSpriteMaxCount", context.spriteHalfMaxCount);
+    }
+    Metrics::Set("DeathFade.Particles", context.deathFadeParticles);
+}
+
 void mainDraw(const GameState& gameState, DrawingContext& context)
 {
     InitWindow(Constants::screenWidth, Constants::screenHeight, "Shallow Update Test");
     SetTargetFPS(60);
 
-    // Load star texture
+    // Load star texture; the sprite renderer keeps pre-tinted copies per country.
     Texture2D starTexture = LoadTexture("star.png");
     Image starImage = GetTextureData(starTexture);
-    Color* starRaw = (Color*)starImage.data;
-
-    std::vector<Color*> countryRaw;
-    countryRaw.resize(Constants::maxCountries);
-
-    for (int i = 0; i < Constants::maxCountries; ++i)
-    {
-        countryRaw[i] = new Color[starImage.width * starImage.height];
-        for (int pixel = 0; pixel < starImage.width * starImage.height; ++pixel)
-        {
-            countryRaw[i][pixel] = starRaw[pixel] * gameState.countryColors.get()[i];
-        }
-    }
+    SpriteRenderer spriteRenderer(starImage, gameState.countryColors.get(), context.sprites);
+    UnloadImage(starImage);
+    UnloadTexture(starTexture);
+    context.spriteBytes = spriteRenderer.GetMemoryBytes();
+    MemoryReport::Track(&spriteRenderer, "Drawing", "sprites", [&context]() { return context.spriteBytes.load(); });
+
+    DensityMap densityMap(context.densityTileSize);
+    DeathFade deathFade;
+    context.deathFadeBytes = deathFade.GetMemoryBytes();
+    MemoryReport::Track(&deathFade, "Drawing", "deathFade", [&context]() { return context.deathFadeBytes.load(); });
+    bool drawDensity = (context.options & Opt::DrawDensity) == Opt::DrawDensity;
+    bool drawSprites = (context.options & Opt::DrawSprites) == Opt::DrawSprites;
+    bool drawMetrics = (context.options & Opt::DrawMetrics) == Opt::DrawMetrics;
+    bool drawFrameAllocations = (context.options & Opt::DrawFrameAllocations) == Opt::DrawFrameAllocations;
 
     while (!WindowShouldClose())
     {
         OPTICK_THREAD("DrawingThread");
 
+        if (IsKeyPressed(KEY_H))
+            drawDensity = !drawDensity;
+        if (IsKeyPressed(KEY_S))
+            drawSprites = !drawSprites;
+        if (IsKeyPressed(KEY_P))
+            drawMetrics = !drawMetrics;
+        if (IsKeyPressed(KEY_A))
+            drawFrameAllocations = !drawFrameAllocations;
+
         {
             OPTICK_EVENT("Wait");
             while (!context.drawingFlag)
@@ -69,46 +94,51 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
 
         Texture armiesTex;
 
-        static std::vector<char> deadArmies;
-        static std::vector<int> deadArmiesIndices;
-        if (deadArmies.size() == 0)
+        // Reused across frames; LoadTextureFromImage copies pixels to the GPU.
+        static std::vector<Color> pixels;
+        if (pixels.size() == 0)
         {
-            deadArmies.resize(Constants::screenWidth * Constants::screenHeight);
-            deadArmiesIndices.resize(Constants::screenWidth * Constants::screenHeight);
-            std::fill(deadArmies.begin(), deadArmies.end(), 0);
-            std::iota(deadArmiesIndices.begin(), deadArmiesIndices.end(), 0);
+            pixels.resize(Constants::screenWidth * Constants::screenHeight);
+            MemoryReport::Track(&pixels, "Drawing", "pixels", pixels);
         }
 
 
         {
             OPTICK_EVENT("Generate Texture");
 
-            Color* pixels = new Color[Constants::screenWidth * Constants::screenHeight];
-            std::fill(pixels, pixels + Constants::screenWidth * Constants::screenHeight, BLACK);
+            std::fill(pixels.begin(), pixels.end(), BLACK);
             std::bitset<Constants::maxArmies> bitset;
 
+            if (drawDensity)
+            {
+                OPTICK_EVENT("Density");
+                densityMap.Accumulate(context.armyIndices, context.armies, gameState.countryColors.get());
+                densityMap.Resolve(pixels);
+            }
+            else if (drawSprites)
+            {
+                OPTICK_EVENT("Sprites");
+                spriteRenderer.Draw(context.armyIndices, context.armies, gameState.countryColors.get(), pixels);
+                context.spritesDrawn = true;
+                context.spritePixels = spriteRenderer.GetPixelCost();
+                context.spriteHalfMaxCount = spriteRenderer.GetHalfSpriteMaxCount();
+                context.spriteBytes = spriteRenderer.GetMemoryBytes();
+            }
+            else
             {
                 OPTICK_EVENT("Armies");
                 parallelFor(context.armyIndices, [&](int index)
                     {
                         int i = context.armyIndices[index];
-                        int screenIndex = Constants::screenWidth * (int)context.armies[i].position.y + (int)context.armies[i].position.x;
-
-                        char hitPointFactor = Constants::armyInitialHitPoints - context.armies[i].getHitPoints() + 1;
+                        const ShallowTest::Vector2 position = context.armies[i].getPosition();
                         const int countryIndex = context.armies[i].getCountryIndex();
                         Color c = gameState.countryColors.get()[countryIndex];
                         c.a = 150;
 
-                        int x = (int)context.armies[i].position.x;
-                        int y = (int)context.armies[i].position.y;
+                        int x = (int)position.x;
+                        int y = (int)position.y;
                         int pixelIndex = y * Constants::screenWidth + x;
 
-                        if (context.armies[i].getHitPoints() == 0)
-                        {
-                            deadArmies[pixelIndex] = 15;
-                        }
-
-                        
                         pixels[pixelIndex] += c;
 
                         const bool right = pixelIndex + 1 < Constants::screenWidth * Constants::screenHeight;
@@ -125,54 +155,19 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
                         if (top)
                             pixels[pixelIndex - Constants::screenWidth] += c;
 
-                        int screenHBegin = std::max(0, x - starImage.width / 2); //std::max(0, starImage.width - x);
-                        int screenVBegin = std::max(0, y - starImage.height / 2); //std::max(0, starImage.height - y);
-                        int screenHEnd = std::min(Constants::screenWidth, x - starImage.width / 2 + starImage.width);
-                        int screenVEnd = std::min(Constants::screenHeight, y - starImage.height / 2+ starImage.height);
-
-                        /*
-                        for (int line = screenVBegin; line < screenVEnd; ++line)
-                        {
-                            int index = line * Constants::screenWidth + screenHBegin;
-                            int end = index + (screenHEnd - screenHBegin);
-                            std::copy(countryRaw[countryIndex] + (line - screenVBegin) * starImage.width, countryRaw[countryIndex] + (line + 1 - screenVBegin) * starImage.width, pixels + index);
-                        }
-                        */
                         bitset.set(index);
                     });
+            }
 
-                /*
-                parallelFor(deadArmiesIndices, [&](int pixelIndex)
-                    {
-                        if (deadArmies[pixelIndex] > 0)
-                        {
-                            Color c = BLACK;
-                            c.r = (char)(255.0f * (float)deadArmies[pixelIndex] / 15);
-
-                            pixels[pixelIndex] += c;
-
-                            const bool right = pixelIndex + 1 < Constants::screenWidth * Constants::screenHeight;
-                            const bool left = pixelIndex > 0;
-                            const bool bottom = pixelIndex + Constants::screenWidth < Constants::screenWidth* Constants::screenHeight;
-                            const bool top = pixelIndex - Constants::screenWidth >= 0;
-
-                            if (right)
-                                pixels[pixelIndex + 1] += c;
-                            if (left)
-                                pixels[pixelIndex - 1] += c;
-                            if (bottom)
-                                pixels[pixelIndex + Constants::screenWidth] += c;
-                            if (top)
-                                pixels[pixelIndex - Constants::screenWidth] += c;
-
-                            --deadArmies[pixelIndex];
-                        }
-                    });
-                    */
-
+            {
+                OPTICK_EVENT("Death Fade");
+                deathFade.Spawn(context.armyIndices, context.armies);
+                deathFade.Draw(pixels);
+                context.deathFadeParticles = deathFade.GetParticleCount();
+                context.deathFadeBytes = deathFade.GetMemoryBytes();
             }
 
-            for (int index = 0; index < context.countryIndices.size(); ++index)
+            for (int index = 0; index < (int)context.countryIndices.size(); ++index)
             {
                 int i = context.countryIndices[index];
                 int pixelIndex = Constants::screenWidth * (int)context.countries[i].position.y + (int)context.countries[i].position.x;
@@ -209,7 +204,7 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
 
             Image armiesImg
             {
-                pixels,
+                pixels.data(),
                 Constants::screenWidth,
                 Constants::screenHeight,
                 1,
@@ -217,7 +212,6 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
             };
 
             armiesTex = LoadTextureFromImage(armiesImg);
-            UnloadImage(armiesImg);
         }
 
         {
@@ -227,7 +221,9 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
             ClearBackground(BLACK);
 
             const int provinceCount = (int)context.provinces.size();
-            const int provincesInRow = (Constants::screenWidth / Constants::provinceSize);
+            const GridGeometry& grid = GridGeometry::Get();
+            const int provinceSize = grid.provinceSize;
+            const int provincesInRow = grid.gridWidth;
 
             DrawTexture(armiesTex, 0, 0, WHITE);
 
@@ -249,41 +245,65 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
                 {
                     c.a = 200;
                     if (context.provinces[i].countryIndex != -1)
-                        DrawRectangle(x * Constants::provinceSize, y * Constants::provinceSize, Constants::provinceSize, Constants::provinceSize, c);
+                        DrawRectangle(x * provinceSize, y * provinceSize, provinceSize, provinceSize, c);
                 }
 
                 if ((context.options & Opt::DrawProvinceArmyCount) == Opt::DrawProvinceArmyCount)
                 {
                     c = WHITE;
                     c.a = std::clamp(context.provinces[i].armyCount._a.load(), 0, 255);
-                    DrawRectangle(x * Constants::provinceSize, y * Constants::provinceSize, Constants::provinceSize, Constants::provinceSize, c);
+                    DrawRectangle(x * provinceSize, y * provinceSize, provinceSize, provinceSize, c);
                 }
 
                 if ((context.options & Opt::DrawVectorField) == Opt::DrawVectorField)
                 {
                     drawArrow(
-                        { (float)x * Constants::provinceSize + Constants::provinceSize / 2, (float)y * Constants::provinceSize + Constants::provinceSize / 2 },
-                        { x * Constants::provinceSize + Constants::provinceSize / 2 + context.flow[i].x * Constants::provinceSize / 2,
-                        y * Constants::provinceSize + Constants::provinceSize / 2 + context.flow[i].y * Constants::provinceSize / 2 });
+                        { (float)x * provinceSize + provinceSize / 2, (float)y * provinceSize + provinceSize / 2 },
+                        { x * provinceSize + provinceSize / 2 + context.flow[i].x * provinceSize / 2,
+                        y * provinceSize + provinceSize / 2 + context.flow[i].y * provinceSize / 2 });
                 }
             }
 
             if ((context.options & Opt::DrawGrid) == Opt::DrawGrid)
             {
-                for (int i = 0; i < Constants::screenWidth / Constants::provinceSize; i++)
-                    DrawLine(i * Constants::provinceSize, 0, i * Constants::provinceSize, Constants::screenHeight, DARKGRAY);
-                for (int i = 0; i < Constants::screenHeight / Constants::provinceSize; i++)
-                    DrawLine(0, i * Constants::provinceSize, Constants::screenWidth, i * Constants::provinceSize, DARKGRAY);
+                for (int i = 0; i < grid.gridWidth; i++)
+                    DrawLine(i * provinceSize, 0, i * provinceSize, Constants::screenHeight, DARKGRAY);
+                for (int i = 0; i < grid.gridHeight; i++)
+                    DrawLine(0, i * provinceSize, Constants::screenWidth, i * provinceSize, DARKGRAY);
             }
 
             DrawFPS(10, 10);
             DrawText((std::to_string(context.armyIndices.size() / 1000) + "k dots").c_str(), 120, 10, 20, YELLOW);
 
-            for (int i = 0; i < context.countryIndices.size(); ++i)
+            // Only as many countries as fit on the screen get a line.
+            const int listedCountryCount = std::min((int)context.countryIndices.size(), (Constants::screenHeight - 45) / 20);
+            for (int i = 0; i < listedCountryCount; ++i)
             {
                 DrawText((std::to_string(context.countries[i].armyCount._a) + " dots").c_str(), 10, 35 + i * 20, 15, gameState.countryColors.get()[i]);
             }
             
+            if (drawMetrics)
+            {
+                DrawText("ms      p50     p95     p99     max", 250, 35, 15, YELLOW);
+                for (int i = 0; i < (int)context.metrics.size(); ++i)
+                {
+                    const MetricsSummary& summary = context.metrics[i];
+                    const int y = 55 + i * 20;
+                    DrawText(TextFormat("%7.2f %7.2f %7.2f %7.2f", summary.p50InMs, summary.p95InMs, summary.p99InMs, summary.maxInMs), 250, y, 15, YELLOW);
+                    DrawText(summary.name, 520, y, 15, YELLOW);
+                }
+            }
+
+            if (drawFrameAllocations)
+            {
+                for (int i = 0; i < (int)context.frameAllocations.size(); ++i)
+                {
+                    const FrameAllocationStats& stats = context.frameAllocations[i];
+                    DrawText((std::string(stats.name) + ": " + std::to_string(stats.allocations) + " allocs, " + std::to_string(stats.bytes / 1024) + " kB").c_str(),
+                        Constants::screenWidth - 620, 10 + i * 20, 15, YELLOW);
+                }
+            }
+
             DrawCircleLines(GetMouseX(), GetMouseY(), context.interactionRadius, GRAY);
 
             EndDrawing();
@@ -313,8 +333,13 @@ void mainDraw(const GameState& gameState, DrawingContext& context)
             slice(gameState.provinces.get(), 0, (int)gameState.provinceIndices.get().size() - 1, context.provinces);
             slice(gameState.countries.get(), 0, (int)gameState.countryIndices.get().size() - 1, context.countries);
             slice(gameState.flow.get(), 0, (int)gameState.provinceIndices.get().size() - 1, context.flow);
+            context.frameAllocations = FrameArena::GetLastFrameStats();
+            context.metrics = Metrics::GetSummary();
         }
 
         context.copyStateFlag = 0;
     }
+
+    MemoryReport::Untrack(&deathFade);
+    MemoryReport::Untrack(&spriteRenderer);
 }
\ No newline at end of file
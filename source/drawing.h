@@ -1,10 +1,14 @@
 #pragma once
+#include <atomic>
 #include <functional>
 #include <vector>
 
 #include "constants.h"
+#include "frame_arena.h"
 #include "game_state.h"
+#include "metrics.h"
 #include "raylib.h"
+#include "sprite_renderer.h"
 
 
 template<class T>
@@ -13,7 +17,7 @@ using ref = std::reference_wrapper<T>;
 struct GameState
 {
 	ref<const std::vector<tArmyIndex>> armyIndices;
-	ref<const std::vector<Army>> armies;
+	ref<const ArmyVector> armies;
 
 	ref<const std::vector<tCountryIndex>> countryIndices;
 	ref<const std::vector<Country>> countries;
@@ -27,7 +31,7 @@ struct GameState
 struct DrawingContext
 {
 	std::vector<tArmyIndex> armyIndices;
-	std::vector<Army> armies;
+	ArmyVector armies;
 
 	std::vector<tCountryIndex> countryIndices;
 	std::vector<Country> countries;
@@ -36,6 +40,9 @@ struct DrawingContext
 	std::vector<Province> provinces;
 	std::vector<ShallowTest::Vector2> flow;
 
+	std::vector<FrameAllocationStats> frameAllocations;
+	std::vector<MetricsSummary> metrics;
+
 	std::atomic<int> drawingFlag;
 	std::atomic<int> copyStateFlag;
 
@@ -48,9 +55,39 @@ struct DrawingContext
 		DrawProvinceOwnership = 0x02,
 		DrawProvinceArmyCount = 0x04,
 		DrawVectorField = 0x08,
+		// Frame arena allocations per system; toggled with A.
+		DrawFrameAllocations = 0x10,
+		// Per-system p50/p95/p99/max timings; toggled with P.
+		DrawMetrics = 0x20,
+		// Army density heatmap instead of one dot per army; toggled with H.
+		DrawDensity = 0x40,
+		// Density dependent star sprites instead of dots; toggled with S.
+		DrawSprites = 0x80,
 	};
 
 	Options options = Options::None;
+
+	// Edge length in pixels of the tiles the density heatmap bins armies into.
+	int densityTileSize = 2;
+
+	// Level of detail limits and pixel budget of the sprite render mode.
+	SpriteRendererConfig sprites;
+
+	// Statistics of the last drawn frame. Written by the drawing thread before it
+	// clears drawingFlag; the main thread publishes them to Metrics during the copy.
+	bool spritesDrawn = false;
+	long long spritePixels = 0;
+	int spriteHalfMaxCount = 0;
+	int deathFadeParticles = 0;
+
+	// Sizes of the drawing thread's own buffers, which grow while drawing, as of
+	// the end of the last frame, so the memory report can read them from any thread.
+	std::atomic<size_t> spriteBytes = 0;
+	std::atomic<size_t> deathFadeBytes = 0;
 };
 
+/// Publishes the drawing statistics to Metrics. Call on the simulation thread
+/// while the drawing thread waits for the state copy.
+void publishDrawingStats(const DrawingContext& context);
+
 void mainDraw(const GameState& gameState, DrawingContext& context);
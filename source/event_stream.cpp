@@ -0,0 +1,153 @@
+#include "event_stream.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include "mpmc_queue.h"
+
+
+namespace
+{
+	// Chunks in flight between the producers and the writer.
+	const int queueCapacity = 1024;
+
+	EventStreamConfig config;
+	std::atomic<bool> enabled = false;
+	std::atomic<bool> stopWriter = false;
+	std::atomic<long long> droppedEvents = 0;
+
+	MpmcQueue<EventChunk*> filledChunks(queueCapacity);
+	MpmcQueue<EventChunk*> freeChunks(queueCapacity);
+
+	void recycle(EventChunk* chunk)
+	{
+		chunk->count = 0;
+		if (!freeChunks.TryPush(chunk))
+			delete chunk;
+	}
+
+	void writerLoop(const std::string& path)
+	{
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		const EventLogHeader header;
+		file.write((const char*)&header, sizeof(header));
+
+		std::vector<char> batch;
+		batch.reserve(config.writeBatchInBytes + sizeof(EventChunk::events));
+
+		auto write = [&]()
+		{
+			file.write(batch.data(), batch.size());
+			file.flush();
+			batch.clear();
+		};
+
+		auto lastChunkTime = std::chrono::steady_clock::now();
+		while (true)
+		{
+			// Sampled before draining, so everything submitted before Shutdown is still written.
+			const bool stopping = stopWriter.load(std::memory_order_acquire);
+
+			bool received = false;
+			EventChunk* chunk;
+			while (filledChunks.TryPop(chunk))
+			{
+				const char* events = (const char*)chunk->events;
+				batch.insert(batch.end(), events, events + chunk->count * sizeof(SimulationEvent));
+				recycle(chunk);
+				received = true;
+
+				if ((int)batch.size() >= config.writeBatchInBytes)
+					write();
+			}
+
+			if (stopping)
+			{
+				write();
+				return;
+			}
+
+			const auto now = std::chrono::steady_clock::now();
+			if (received)
+			{
+				lastChunkTime = now;
+				continue;
+			}
+
+			if (!batch.empty() && now - lastChunkTime > std::chrono::milliseconds(config.idleFlushInMs))
+				write();
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// Declared after the queues, so it is destroyed, and the writer joined, before them.
+	struct WriterThread
+	{
+		std::thread thread;
+
+		~WriterThread()
+		{
+			EventStream::Shutdown();
+		}
+	} writer;
+}
+
+void EventStream::Configure(const EventStreamConfig& newConfig)
+{
+	Shutdown();
+
+	config = newConfig;
+	if (config.path.empty())
+		return;
+
+	stopWriter = false;
+	enabled = true;
+	writer.thread = std::thread(writerLoop, config.path);
+}
+
+void EventStream::Shutdown()
+{
+	if (!writer.thread.joinable())
+		return;
+
+	enabled = false;
+	stopWriter.store(true, std::memory_order_release);
+	writer.thread.join();
+}
+
+bool EventStream::IsEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+bool EventStream::IsTotalsTick(unsigned int tick)
+{
+	return config.totalsIntervalInTicks > 0 && tick % config.totalsIntervalInTicks == 0;
+}
+
+long long EventStream::GetDroppedEventCount()
+{
+	return droppedEvents.load(std::memory_order_relaxed);
+}
+
+EventChunk* EventStream::AcquireChunk()
+{
+	EventChunk* chunk;
+	if (freeChunks.TryPop(chunk))
+		return chunk;
+
+	return new EventChunk();
+}
+
+void EventStream::SubmitChunk(EventChunk* chunk)
+{
+	if (chunk->count > 0 && IsEnabled() && filledChunks.TryPush(chunk))
+		return;
+
+	droppedEvents += chunk->count;
+	recycle(chunk);
+}
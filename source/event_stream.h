@@ -0,0 +1,114 @@
+#pragma once
+#include <string>
+
+
+enum class SimulationEventType : unsigned short
+{
+	// countryIndex: new owner, first: province index, second: previous owner or -1.
+	ProvinceOwnerChanged = 1,
+	// countryIndex: country, first: armies killed this tick.
+	ArmiesKilled = 2,
+	// countryIndex: country, first: armies spawned this tick.
+	ArmiesSpawned = 3,
+	// countryIndex: country, first: army count, second: province count.
+	CountryTotals = 4,
+};
+
+/// Record of the binary event log, written as is (little endian) after an
+/// EventLogHeader.
+struct SimulationEvent
+{
+	unsigned int tick;
+	SimulationEventType type;
+	short countryIndex;
+	int first;
+	int second;
+};
+
+static_assert(sizeof(SimulationEvent) == 16);
+
+struct EventLogHeader
+{
+	char magic[4] = { 'S', 'T', 'E', 'V' };
+	unsigned int version = 1;
+	unsigned int eventSize = sizeof(SimulationEvent);
+	unsigned int reserved = 0;
+};
+
+struct EventStreamConfig
+{
+	// Binary log written by the background writer; empty disables the stream.
+	std::string path = "";
+	// Country totals are published every this many ticks.
+	int totalsIntervalInTicks = 10;
+	// Bytes collected before the writer issues a write.
+	int writeBatchInBytes = 1 << 20;
+	// Partially filled batches are written after this long without new events.
+	int idleFlushInMs = 100;
+};
+
+/// Fixed block of events handed from a producer to the writer in one piece.
+struct EventChunk
+{
+	static const int capacity = 1024;
+
+	int count = 0;
+	SimulationEvent events[capacity];
+};
+
+/// Structured simulation events for offline analysis. Producers fill local
+/// EventBatch buffers and pass full chunks through a lock-free queue to a
+/// background thread that appends them to the log in large writes, so
+/// publishing never waits on I/O. If the writer falls behind, chunks are
+/// dropped and counted rather than blocking the simulation.
+class EventStream
+{
+public:
+	/// Starts the writer thread; an empty path stops it.
+	static void Configure(const EventStreamConfig& config);
+
+	/// Writes everything queued so far and stops the writer thread.
+	static void Shutdown();
+
+	static bool IsEnabled();
+	static bool IsTotalsTick(unsigned int tick);
+	static long long GetDroppedEventCount();
+
+	static EventChunk* AcquireChunk();
+	static void SubmitChunk(EventChunk* chunk);
+};
+
+/// Per-task event buffer; submits its chunk when full and when destroyed.
+/// Not shared between threads, so adding an event is a plain store.
+class EventBatch
+{
+public:
+	EventBatch() = default;
+	EventBatch(const EventBatch&) = delete;
+	EventBatch& operator=(const EventBatch&) = delete;
+
+	~EventBatch()
+	{
+		Submit();
+	}
+
+	void Add(const SimulationEvent& event)
+	{
+		if (!chunk)
+			chunk = EventStream::AcquireChunk();
+
+		chunk->events[chunk->count++] = event;
+		if (chunk->count == EventChunk::capacity)
+			Submit();
+	}
+
+	void Submit()
+	{
+		if (chunk)
+			EventStream::SubmitChunk(chunk);
+		chunk = nullptr;
+	}
+
+private:
+	EventChunk* chunk = nullptr;
+};
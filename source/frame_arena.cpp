@@ -0,0 +1,169 @@
+#include "frame_arena.h"
+
+#include <algorithm>
+#include <array>
+#include <assert.h>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+
+namespace
+{
+	struct FrameAllocationCounter
+	{
+		const char* name = nullptr;
+		std::atomic<size_t> allocations = 0;
+		std::atomic<size_t> bytes = 0;
+	};
+
+	const int maxCounters = 64;
+	const size_t blockAlignment = 64;
+
+	// Counter 0 collects allocations made outside of any FrameArenaScope.
+	std::array<FrameAllocationCounter, maxCounters> counters;
+	int counterCount = 1;
+	std::atomic<int> currentCounter = 0;
+
+	std::atomic<size_t> reservedBytes = 0;
+
+	std::mutex lastFrameStatsMutex;
+	std::vector<FrameAllocationStats> lastFrameStats;
+
+	int findOrAddCounter(const char* name)
+	{
+		for (int i = 1; i < counterCount; ++i)
+		{
+			if (counters[i].name == name || std::strcmp(counters[i].name, name) == 0)
+				return i;
+		}
+
+		if (counterCount == maxCounters)
+			return 0;
+
+		counters[counterCount].name = name;
+		return counterCount++;
+	}
+}
+
+std::atomic<unsigned int> FrameArena::frameEpoch = 1;
+
+FrameArena::~FrameArena()
+{
+	for (Block& block : blocks)
+	{
+		::operator delete(block.data, std::align_val_t(blockAlignment));
+		reservedBytes -= block.size;
+	}
+}
+
+FrameArena& FrameArena::Local()
+{
+	thread_local FrameArena arena;
+
+	const unsigned int currentEpoch = frameEpoch.load(std::memory_order_acquire);
+	if (arena.epoch != currentEpoch)
+	{
+		arena.Reset();
+		arena.epoch = currentEpoch;
+	}
+
+	return arena;
+}
+
+void FrameArena::BeginFrame()
+{
+	counters[0].name = "Other";
+
+	{
+		std::lock_guard<std::mutex> lock(lastFrameStatsMutex);
+		lastFrameStats.clear();
+		for (int i = 0; i < counterCount; ++i)
+		{
+			lastFrameStats.push_back({ counters[i].name, counters[i].allocations.exchange(0), counters[i].bytes.exchange(0) });
+		}
+	}
+
+	frameEpoch.fetch_add(1, std::memory_order_release);
+}
+
+std::vector<FrameAllocationStats> FrameArena::GetLastFrameStats()
+{
+	std::lock_guard<std::mutex> lock(lastFrameStatsMutex);
+	return lastFrameStats;
+}
+
+size_t FrameArena::GetReservedBytes()
+{
+	return reservedBytes.load(std::memory_order_relaxed);
+}
+
+void* FrameArena::do_allocate(size_t bytes, size_t alignment)
+{
+	assert(alignment <= blockAlignment);
+
+	FrameAllocationCounter& counter = counters[currentCounter.load(std::memory_order_relaxed)];
+	counter.allocations.fetch_add(1, std::memory_order_relaxed);
+	counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+
+	if (!blocks.empty())
+	{
+		const size_t alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+		if (alignedOffset + bytes <= blocks.back().size)
+		{
+			offset = alignedOffset + bytes;
+			return blocks.back().data + alignedOffset;
+		}
+	}
+
+	AddBlock(bytes + alignment);
+
+	const size_t alignedOffset = (offset + alignment - 1) & ~(alignment - 1);
+	offset = alignedOffset + bytes;
+	return blocks.back().data + alignedOffset;
+}
+
+void FrameArena::Reset()
+{
+	// Coalesce into one block sized for the whole previous frame, so a steady
+	// frame stays inside a single block and never goes back to the heap.
+	if (blocks.size() > 1)
+	{
+		const size_t totalSize = usedInPreviousBlocks + blocks.back().size;
+		for (Block& block : blocks)
+		{
+			::operator delete(block.data, std::align_val_t(blockAlignment));
+			reservedBytes -= block.size;
+		}
+		blocks.clear();
+		AddBlock(totalSize);
+	}
+
+	offset = 0;
+	usedInPreviousBlocks = 0;
+}
+
+void FrameArena::AddBlock(size_t minSize)
+{
+	size_t size = blocks.empty() ? initialBlockSize : blocks.back().size * 2;
+	size = std::max(size, minSize);
+
+	if (!blocks.empty())
+		usedInPreviousBlocks += blocks.back().size;
+
+	char* data = (char*)::operator new(size, std::align_val_t(blockAlignment));
+	reservedBytes += size;
+	blocks.push_back({ data, size });
+	offset = 0;
+}
+
+FrameArenaScope::FrameArenaScope(const char* name)
+	: previousCounter(currentCounter.load(std::memory_order_relaxed))
+{
+	currentCounter.store(findOrAddCounter(name), std::memory_order_relaxed);
+}
+
+FrameArenaScope::~FrameArenaScope()
+{
+	currentCounter.store(previousCounter, std::memory_order_relaxed);
+}
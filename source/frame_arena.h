@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+
+struct FrameAllocationStats
+{
+	const char* name;
+	size_t allocations;
+	size_t bytes;
+};
+
+/// Per-thread bump allocator for scratch data that lives at most one frame.
+/// Every thread gets its own arena through Resource(), so workers never contend
+/// on a shared heap. Deallocation is a no-op; all memory is reclaimed at once
+/// the first time a thread allocates after FrameArena::BeginFrame().
+/// Memory obtained from the arena must not be held across a frame boundary.
+class FrameArena : public std::pmr::memory_resource
+{
+public:
+	FrameArena() = default;
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+	~FrameArena();
+
+	/// Arena of the calling thread.
+	static FrameArena& Local();
+	static std::pmr::memory_resource* Resource() { return &Local(); }
+
+	/// Marks the frame boundary. Called from the simulation thread while no
+	/// system is running. Publishes the allocation counters of the finished frame.
+	static void BeginFrame();
+
+	/// Allocation counters per system for the last finished frame.
+	static std::vector<FrameAllocationStats> GetLastFrameStats();
+
+	/// Bytes held in blocks by the arenas of all threads.
+	static size_t GetReservedBytes();
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t size;
+	};
+
+	void* do_allocate(size_t bytes, size_t alignment) override;
+	void do_deallocate(void*, size_t, size_t) override {}
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+	void Reset();
+	void AddBlock(size_t minSize);
+
+	static const size_t initialBlockSize = 1 << 20;
+
+	std::vector<Block> blocks;
+	size_t offset = 0;
+	size_t usedInPreviousBlocks = 0;
+	unsigned int epoch = 0;
+
+	static std::atomic<unsigned int> frameEpoch;
+};
+
+/// Attributes arena allocations to a system until the scope ends. Opened on the
+/// simulation thread; allocations made by workers on its behalf are counted too.
+class FrameArenaScope
+{
+public:
+	explicit FrameArenaScope(const char* name);
+	~FrameArenaScope();
+
+private:
+	int previousCounter;
+};
@@ -0,0 +1,109 @@
+#pragma once
+#include <algorithm>
+
+
+struct FrameGovernorConfig
+{
+	bool enabled = false;
+	// Target tick duration; leaves room in the 60 Hz frame for the copy to the drawing thread.
+	float frameBudgetInMs = 12.0f;
+	// Highest degradation level, see FrameGovernor::GetSettings.
+	int maxLevel = 4;
+	// Ticks over budget before degrading one level.
+	int degradeAfterTicks = 15;
+	// Ticks below recoverFraction of the budget before recovering one level.
+	int recoverAfterTicks = 120;
+	float recoverFraction = 0.6f;
+};
+
+/// Keeps the tick within a time budget by trading fidelity for time. Every tick
+/// reports its duration; a sustained overrun raises the degradation level by one,
+/// and sustained headroom lowers it again, with hysteresis between the two so the
+/// level does not oscillate. Disabled, the level stays at 0 (full fidelity).
+class FrameGovernor
+{
+public:
+	struct Settings
+	{
+		// Armies move in stride groups, one group per tick, with stride times the delta.
+		int armyUpdateStride = 1;
+		// Ticks between flow field updates.
+		int flowInterval = 1;
+		// Ticks between province ownership votes.
+		int voteInterval = 1;
+		// Ticks between separation force updates; armies keep the last forces in between.
+		int separationInterval = 1;
+	};
+
+	FrameGovernor() = default;
+	explicit FrameGovernor(const FrameGovernorConfig& config)
+		: config(config)
+	{}
+
+	void Configure(const FrameGovernorConfig& newConfig)
+	{
+		config = newConfig;
+		level = 0;
+		averageInMs = 0.0f;
+		overBudgetTicks = 0;
+		underBudgetTicks = 0;
+	}
+
+	bool IsEnabled() const { return config.enabled; }
+	int GetLevel() const { return level; }
+	float GetAverageTickInMs() const { return averageInMs; }
+
+	/// Cheapest settings first dropped: flow, vote and separation, then army movement.
+	Settings GetSettings() const
+	{
+		static const Settings levels[] = {
+			{ 1, 1, 1, 1 },
+			{ 1, 2, 2, 2 },
+			{ 2, 2, 2, 2 },
+			{ 2, 4, 4, 4 },
+			{ 4, 4, 4, 4 },
+		};
+		const int maxTableLevel = (int)(sizeof(levels) / sizeof(levels[0])) - 1;
+		return levels[std::min(level, maxTableLevel)];
+	}
+
+	/// True on the ticks where a system running every interval ticks is due.
+	static bool IsDue(unsigned int tick, int interval)
+	{
+		return interval <= 1 || tick % interval == 0;
+	}
+
+	void TickCompleted(float tickInMs)
+	{
+		if (!config.enabled)
+			return;
+
+		// Smooths single spikes, such as a spawn wave, out of the decision.
+		const float smoothing = 0.1f;
+		averageInMs = averageInMs == 0.0f ? tickInMs : averageInMs + (tickInMs - averageInMs) * smoothing;
+
+		overBudgetTicks = averageInMs > config.frameBudgetInMs ? overBudgetTicks + 1 : 0;
+		underBudgetTicks = averageInMs < config.frameBudgetInMs * config.recoverFraction ? underBudgetTicks + 1 : 0;
+
+		if (overBudgetTicks >= config.degradeAfterTicks && level < config.maxLevel)
+			changeLevel(level + 1);
+		else if (underBudgetTicks >= config.recoverAfterTicks && level > 0)
+			changeLevel(level - 1);
+	}
+
+private:
+	void changeLevel(int newLevel)
+	{
+		level = newLevel;
+		// The average restarts from the first tick at the new level.
+		averageInMs = 0.0f;
+		overBudgetTicks = 0;
+		underBudgetTicks = 0;
+	}
+
+	FrameGovernorConfig config;
+	int level = 0;
+	float averageInMs = 0.0f;
+	int overBudgetTicks = 0;
+	int underBudgetTicks = 0;
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <vector>
 
 // https://stackoverflow.com/questions/41946007/efficient-and-well-explained-implementation-of-a-quadtree-for-2d-collision-det
@@ -26,6 +27,9 @@ public:
     // Returns the range of valid indices.
     int range() const;
 
+    // Returns the bytes held by the list.
+    size_t memory() const { return data.capacity() * sizeof(FreeElement); }
+
     // Returns the nth element.
     T& operator[](int n);
 
@@ -1,7 +1,11 @@
 #pragma once
+#include <assert.h>
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 
 #include "constants.h"
+#include "large_pages.h"
 #include "vector2.h"
 
 typedef int tCountryIndex;
@@ -54,44 +58,166 @@ struct Province
 	short prevCountryIndex = -1;
 	short countryIndex = -1;
 	int armyStartIndex = 0;
-	AtomWrapper<int> armyCount = 0;
+	AtomWrapper<int> armyCount{};
+
+	// Winner of the last ownership vote and how many of the province armies it has.
+	short majorityCountryIndex = -1;
+	int majorityArmyCount = 0;
 };
 
-struct Army
+struct FloatArmy
 {
+	// Province::countryIndex is a short, so indices stop at 0x7FFF even though the flags have 16 bits.
+	static constexpr int maxCountryCount = 0x7FFF;
+	static constexpr int maxHitPoints = 0xFF;
+
 	ShallowTest::Vector2 position{ 100, 100 };
 
-	// 0-3 Country Index
-	// 4 Valid
-	// 8-15 Hit Points
-	int flags = 0x000000E0;
+	// 0-15 Country Index
+	// 16 Valid
+	// 24-31 Hit Points
+	unsigned int flags = 0;
 	int provinceIndex = -1;
 
 	bool isValid() const
 	{
-		return (flags & 0x00000010) == 0x00000010;
+		return (flags & 0x00010000) == 0x00010000;
 	}
 
-	char getCountryIndex() const
+	tCountryIndex getCountryIndex() const
 	{
-		return (flags & 0x0000000F);
+		return (flags & 0x0000FFFF);
 	}
 
-	void setCountryIndex(char index)
+	void setCountryIndex(tCountryIndex index)
 	{
-		flags = (flags & ~0x0F) | index;
+		assert(index >= 0 && index < maxCountryCount);
+		flags = (flags & ~0x0000FFFFu) | (unsigned int)index;
 	}
 
 	void invalidate()
 	{
-		flags &= ~0x00000010;
+		flags &= ~0x00010000u;
 	}
 
 	void validate()
 	{
-		flags |= 0x00000010;
+		flags |= 0x00010000u;
 	}
 
-	char getHitPoints() { return (flags & 0x0000FF00) >> 8; }
-	void setHitPoints(unsigned char hitPoints) { flags = (flags & ~0x0000FF00) | hitPoints << 8; }
+	char getHitPoints() const { return (char)(flags >> 24); }
+
+	// Same clamping as CompactArmy::setHitPoints, to the 8 bit range.
+	void setHitPoints(int value)
+	{
+		const unsigned int hitPoints = (unsigned int)std::clamp(value, 0, maxHitPoints);
+		flags = (flags & ~0xFF000000u) | hitPoints << 24;
+	}
+
+	ShallowTest::Vector2 getPosition() const { return position; }
+	void setPosition(const ShallowTest::Vector2& value) { position = value; }
+
+	tProvinceIndex getProvinceIndex() const { return provinceIndex; }
+	void setProvinceIndex(tProvinceIndex index) { provinceIndex = index; }
 };
+
+/// Half-size army. Coordinates are unsigned 11.5 fixed point, so every position
+/// inside the world is a multiple of 1/32 px and converts to float exactly.
+struct CompactArmy
+{
+	static const int fractionBits = 5;
+	static const int countryBits = 10;
+	static constexpr int maxCountryCount = 1 << countryBits;
+	static const int maxHitPoints = (1 << (16 - countryBits)) - 1;
+	static const unsigned short noProvince = 0x7FFF;
+
+	unsigned short x = 100 << fractionBits;
+	unsigned short y = 100 << fractionBits;
+
+	// 0-14 Province Index
+	// 15 Valid
+	unsigned short province = noProvince;
+
+	// 0-9 Country Index
+	// 10-15 Hit Points
+	unsigned short countryAndHitPoints = 0;
+
+	static unsigned short Quantize(float value)
+	{
+		return (unsigned short)std::clamp(std::lround(value * (1 << fractionBits)), 0L, 0xFFFFL);
+	}
+
+	static float Dequantize(unsigned short value)
+	{
+		return (float)value / (float)(1 << fractionBits);
+	}
+
+	bool isValid() const
+	{
+		return (province & 0x8000) == 0x8000;
+	}
+
+	tCountryIndex getCountryIndex() const
+	{
+		return countryAndHitPoints & (maxCountryCount - 1);
+	}
+
+	void setCountryIndex(tCountryIndex index)
+	{
+		assert(index >= 0 && index < maxCountryCount);
+		countryAndHitPoints = (unsigned short)((countryAndHitPoints & ~(maxCountryCount - 1)) | index);
+	}
+
+	void invalidate()
+	{
+		province &= ~0x8000;
+	}
+
+	void validate()
+	{
+		province |= 0x8000;
+	}
+
+	char getHitPoints() const { return (char)(countryAndHitPoints >> countryBits); }
+
+	// Takes an int so hit points decremented below zero clamp to 0 instead of
+	// wrapping around to full health; values past the 6 bit range clamp to maxHitPoints.
+	void setHitPoints(int value)
+	{
+		const unsigned short hitPoints = (unsigned short)std::clamp(value, 0, (int)maxHitPoints);
+		countryAndHitPoints = (unsigned short)((countryAndHitPoints & (maxCountryCount - 1)) | hitPoints << countryBits);
+	}
+
+	ShallowTest::Vector2 getPosition() const { return { Dequantize(x), Dequantize(y) }; }
+	void setPosition(const ShallowTest::Vector2& value) { x = Quantize(value.x); y = Quantize(value.y); }
+
+	tProvinceIndex getProvinceIndex() const
+	{
+		const int index = province & 0x7FFF;
+		return index == noProvince ? -1 : index;
+	}
+
+	void setProvinceIndex(tProvinceIndex index)
+	{
+		assert(index < noProvince);
+		province = (unsigned short)((province & 0x8000) | (index < 0 ? noProvince : index));
+	}
+};
+
+static_assert(sizeof(CompactArmy) == 8);
+static_assert(Constants::screenWidth << CompactArmy::fractionBits <= 0xFFFF);
+static_assert(Constants::screenHeight << CompactArmy::fractionBits <= 0xFFFF);
+static_assert(Constants::gridWidth * Constants::gridHeight <= CompactArmy::noProvince);
+static_assert(Constants::maxCountries <= CompactArmy::maxCountryCount);
+static_assert(Constants::armyInitialHitPoints <= CompactArmy::maxHitPoints);
+
+// Build with SHALLOW_TEST_COMPACT_ARMY to run the simulation on the 8 byte layout.
+#if defined(SHALLOW_TEST_COMPACT_ARMY)
+typedef CompactArmy Army;
+#else
+typedef FloatArmy Army;
+#endif
+
+// Arrays spanning the whole army range live on large, huge page aligned buffers.
+typedef LargeVector<Army> ArmyVector;
+typedef LargeVector<ShallowTest::Vector2> ArmyVectorField;
@@ -0,0 +1,185 @@
+#pragma once
+#include <assert.h>
+#include <cstdint>
+
+#include "constants.h"
+#include "game_state.h"
+#include "vector2.h"
+
+
+/// Province grid laid over the screen, chosen at startup.
+/// Methods here use plain division and are meant for cold paths; hot kernels
+/// go through dispatchGrid to get a StaticGrid or DynamicGrid.
+struct GridGeometry
+{
+	int provinceSize = Constants::provinceSize;
+	int gridWidth = Constants::gridWidth;
+	int gridHeight = Constants::gridHeight;
+
+	int GetProvinceCount() const { return gridWidth * gridHeight; }
+
+	tProvinceIndex GetProvinceIndexForPosition(const ShallowTest::Vector2& position) const
+	{
+		return ((int)position.y / provinceSize) * gridWidth + (int)position.x / provinceSize;
+	}
+
+	ShallowTest::Vector2 GetPositionFromProvinceIndex(tProvinceIndex index) const
+	{
+		const int y = index / gridWidth;
+		const int x = index - y * gridWidth;
+		return { (float)(x * provinceSize), (float)(y * provinceSize) };
+	}
+
+	static GridGeometry FromProvinceSize(int provinceSize)
+	{
+		assert(Constants::screenWidth % provinceSize == 0);
+		assert(Constants::screenHeight % provinceSize == 0);
+		return { provinceSize, Constants::screenWidth / provinceSize, Constants::screenHeight / provinceSize };
+	}
+
+	static const GridGeometry& Get()
+	{
+		return current();
+	}
+
+	/// Must be called before the world is created.
+	static void Set(const GridGeometry& geometry)
+	{
+		current() = geometry;
+	}
+
+private:
+	static GridGeometry& current()
+	{
+		static GridGeometry geometry;
+		return geometry;
+	}
+};
+
+/// Geometry known at compile time; index math constant-folds into multiplies and shifts.
+/// Positions are never negative, so integer division matches the float truncation.
+template<int ProvinceSize, int GridWidth, int GridHeight>
+struct StaticGrid
+{
+	static_assert(ProvinceSize * GridWidth == Constants::screenWidth);
+	static_assert(ProvinceSize * GridHeight == Constants::screenHeight);
+
+	static bool Matches(const GridGeometry& geometry)
+	{
+		return geometry.provinceSize == ProvinceSize && geometry.gridWidth == GridWidth && geometry.gridHeight == GridHeight;
+	}
+
+	int GetProvinceSize() const { return ProvinceSize; }
+	int GetWidth() const { return GridWidth; }
+	int GetHeight() const { return GridHeight; }
+	int GetProvinceCount() const { return GridWidth * GridHeight; }
+	float GetInvWidth() const { return 1.0f / GridWidth; }
+	float GetInvHeight() const { return 1.0f / GridHeight; }
+
+	int GetX(tProvinceIndex index) const { return (unsigned int)index % GridWidth; }
+	int GetY(tProvinceIndex index) const { return (unsigned int)index / GridWidth; }
+
+	tProvinceIndex GetProvinceIndexForPosition(const ShallowTest::Vector2& position) const
+	{
+		return ((unsigned int)position.y / ProvinceSize) * GridWidth + (unsigned int)position.x / ProvinceSize;
+	}
+};
+
+/// Geometry only known at runtime. Divisions by the province size and grid width
+/// use precomputed multiply-shift reciprocals, exact for dividends below 2^21
+/// (screen coordinates and province indices).
+struct DynamicGrid
+{
+	explicit DynamicGrid(const GridGeometry& geometry)
+		: provinceSize(geometry.provinceSize)
+		, gridWidth(geometry.gridWidth)
+		, gridHeight(geometry.gridHeight)
+		, provinceSizeReciprocal(Reciprocal(geometry.provinceSize))
+		, gridWidthReciprocal(Reciprocal(geometry.gridWidth))
+		, invWidth(1.0f / geometry.gridWidth)
+		, invHeight(1.0f / geometry.gridHeight)
+	{
+		assert(geometry.GetProvinceCount() < (1 << 21));
+	}
+
+	int GetProvinceSize() const { return provinceSize; }
+	int GetWidth() const { return gridWidth; }
+	int GetHeight() const { return gridHeight; }
+	int GetProvinceCount() const { return gridWidth * gridHeight; }
+	float GetInvWidth() const { return invWidth; }
+	float GetInvHeight() const { return invHeight; }
+
+	int GetX(tProvinceIndex index) const { return index - GetY(index) * gridWidth; }
+	int GetY(tProvinceIndex index) const { return Divide((unsigned int)index, gridWidthReciprocal); }
+
+	tProvinceIndex GetProvinceIndexForPosition(const ShallowTest::Vector2& position) const
+	{
+		const int x = Divide((unsigned int)position.x, provinceSizeReciprocal);
+		const int y = Divide((unsigned int)position.y, provinceSizeReciprocal);
+		return y * gridWidth + x;
+	}
+
+private:
+	// ceil(2^32 / d): the rounding error stays below 1/d as long as n * d < 2^32.
+	static uint64_t Reciprocal(int divisor)
+	{
+		return ((1ull << 32) + divisor - 1) / divisor;
+	}
+
+	static int Divide(unsigned int n, uint64_t reciprocal)
+	{
+		return (int)((n * reciprocal) >> 32);
+	}
+
+	int provinceSize;
+	int gridWidth;
+	int gridHeight;
+	uint64_t provinceSizeReciprocal;
+	uint64_t gridWidthReciprocal;
+	float invWidth;
+	float invHeight;
+};
+
+template<class... Grids>
+struct GridDispatchTable
+{
+	/// Calls fn with the first grid type matching the geometry, or with a DynamicGrid.
+	template<class Fn>
+	static void Dispatch(const GridGeometry& geometry, Fn&& fn)
+	{
+		const bool dispatched = (TryDispatch<Grids>(geometry, fn) || ...);
+		if (!dispatched)
+			fn(DynamicGrid(geometry));
+	}
+
+private:
+	template<class Grid, class Fn>
+	static bool TryDispatch(const GridGeometry& geometry, Fn& fn)
+	{
+		if (!Grid::Matches(geometry))
+			return false;
+
+		fn(Grid());
+		return true;
+	}
+};
+
+// Every province size from 8 to 60 px that tiles the 1920x1080 screen; 120 px falls back to DynamicGrid.
+using CommonGrids = GridDispatchTable<
+	StaticGrid<Constants::provinceSize, Constants::gridWidth, Constants::gridHeight>,
+	StaticGrid<8, 240, 135>,
+	StaticGrid<10, 192, 108>,
+	StaticGrid<12, 160, 90>,
+	StaticGrid<15, 128, 72>,
+	StaticGrid<20, 96, 54>,
+	StaticGrid<24, 80, 45>,
+	StaticGrid<40, 48, 27>,
+	StaticGrid<60, 32, 18>>;
+
+/// Runs a grid-dependent kernel with the geometry as a template parameter:
+/// dispatchGrid(geometry, [&](const auto& grid) { ... });
+template<class Fn>
+void dispatchGrid(const GridGeometry& geometry, Fn&& fn)
+{
+	CommonGrids::Dispatch(geometry, fn);
+}
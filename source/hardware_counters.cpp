@@ -0,0 +1,372 @@
+#include "hardware_counters.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <mutex>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace
+{
+	struct Scope
+	{
+		const char* name = nullptr;
+		HardwareCounters::Sample frameTotal;
+		bool recordedThisFrame = false;
+	};
+
+	const int maxScopes = 64;
+
+	std::atomic<bool> enabled = false;
+	thread_local bool isRecordingThread = false;
+
+	// Pool work done for the recording thread's jobs, summed over the workers.
+	std::atomic<long long> workerTotals[HardwareCounters::EventCount] = {};
+
+	// Recorded on the simulation thread only.
+	std::array<Scope, maxScopes> scopes;
+	int scopeCount = 0;
+
+	std::mutex publishedMutex;
+	std::vector<HardwareCountersSummary> published;
+
+	Scope& findOrAddScope(const char* name)
+	{
+		for (int i = 0; i < scopeCount; ++i)
+		{
+			if (scopes[i].name == name || std::strcmp(scopes[i].name, name) == 0)
+				return scopes[i];
+		}
+
+		if (scopeCount == maxScopes)
+			return scopes[maxScopes - 1];
+
+		scopes[scopeCount].name = name;
+		return scopes[scopeCount++];
+	}
+
+#if defined(__linux__)
+	struct EventConfig
+	{
+		unsigned int type;
+		unsigned long long config;
+	};
+
+	// In HardwareCounters::Event order; cycles lead the group.
+	const EventConfig eventConfigs[HardwareCounters::EventCount] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+	};
+
+	struct CountedThread
+	{
+		pid_t threadId;
+		// -1 until the counters are enabled.
+		int groupFd = -1;
+		std::vector<int> fds;
+		// Event of each value in a group read, in read order.
+		std::vector<HardwareCounters::Event> events;
+	};
+
+	struct Registry
+	{
+		std::mutex mutex;
+		// A list, so each thread's entry stays put while others come and go.
+		std::list<CountedThread> threads;
+	};
+
+	// Entry of the calling thread while it is registered.
+	thread_local CountedThread* currentThread = nullptr;
+
+	// Never destroyed: the pool's workers unregister while static destructors run.
+	Registry& registry()
+	{
+		static Registry* instance = new Registry();
+		return *instance;
+	}
+
+	// Events the CPU provides, found when the counters are enabled.
+	bool available[HardwareCounters::EventCount] = {};
+
+	pid_t currentThreadId()
+	{
+		return (pid_t)syscall(SYS_gettid);
+	}
+
+	int openEvent(pid_t threadId, int groupFd, HardwareCounters::Event event)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = eventConfigs[event].type;
+		attr.config = eventConfigs[event].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(SYS_perf_event_open, &attr, threadId, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+	}
+
+	// Opens the events marked available; with probe set, marks which ones open.
+	bool openThread(CountedThread& thread, bool probe)
+	{
+		thread.groupFd = openEvent(thread.threadId, -1, HardwareCounters::Cycles);
+		if (thread.groupFd < 0)
+			return false;
+		thread.fds.push_back(thread.groupFd);
+		thread.events.push_back(HardwareCounters::Cycles);
+
+		for (int e = HardwareCounters::Cycles + 1; e < HardwareCounters::EventCount; ++e)
+		{
+			if (!probe && !available[e])
+				continue;
+
+			const int fd = openEvent(thread.threadId, thread.groupFd, (HardwareCounters::Event)e);
+			if (probe)
+				available[e] = fd >= 0;
+			if (fd < 0)
+				continue;
+			thread.fds.push_back(fd);
+			thread.events.push_back((HardwareCounters::Event)e);
+		}
+
+		if (probe)
+			available[HardwareCounters::Cycles] = true;
+		return true;
+	}
+
+	void closeThread(CountedThread& thread)
+	{
+		for (int fd : thread.fds)
+			close(fd);
+		thread.fds.clear();
+		thread.events.clear();
+		thread.groupFd = -1;
+	}
+
+	// Adds the thread's running totals, scaled up for the time the kernel
+	// multiplexed its group off the CPU.
+	void readThread(const CountedThread& thread, HardwareCounters::Sample& sample)
+	{
+		if (thread.groupFd < 0)
+			return;
+
+		// nr, time enabled, time running, then one value per event.
+		unsigned long long buffer[3 + HardwareCounters::EventCount] = {};
+		if (read(thread.groupFd, buffer, sizeof(buffer)) <= 0)
+			return;
+
+		const unsigned long long timeEnabled = buffer[1];
+		const unsigned long long timeRunning = buffer[2];
+		if (timeRunning == 0)
+			return;
+
+		const double scale = (double)timeEnabled / (double)timeRunning;
+		const int valueCount = std::min((int)buffer[0], (int)thread.events.size());
+		for (int i = 0; i < valueCount; ++i)
+			sample.values[thread.events[i]] += (long long)((double)buffer[3 + i] * scale);
+	}
+#endif
+
+	bool isAvailable(HardwareCounters::Event event)
+	{
+#if defined(__linux__)
+		return available[event];
+#else
+		return false;
+#endif
+	}
+
+	float perArmy(const HardwareCounters::Sample& sample, HardwareCounters::Event event, int armyCount)
+	{
+		return isAvailable(event) ? (float)sample.values[event] / (float)std::max(1, armyCount) : -1.0f;
+	}
+}
+
+bool HardwareCounters::Enable()
+{
+#if defined(__linux__)
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	if (enabled)
+		return true;
+
+	// The enabling thread probes which events the CPU provides.
+	const pid_t threadId = currentThreadId();
+	auto self = std::find_if(r.threads.begin(), r.threads.end(), [&](const CountedThread& t) { return t.threadId == threadId; });
+	if (self == r.threads.end())
+	{
+		CountedThread thread{};
+		thread.threadId = threadId;
+		r.threads.push_back(std::move(thread));
+		self = std::prev(r.threads.end());
+	}
+
+	if (!openThread(*self, true))
+	{
+		const int error = errno;
+		std::fprintf(stderr, "Hardware counters unavailable: %s%s\n", std::strerror(error),
+			error == EACCES || error == EPERM ? "; check /proc/sys/kernel/perf_event_paranoid" : "");
+		return false;
+	}
+
+	for (CountedThread& thread : r.threads)
+	{
+		if (thread.groupFd < 0)
+			openThread(thread, false);
+	}
+
+	currentThread = &*self;
+	isRecordingThread = true;
+	enabled = true;
+	return true;
+#else
+	std::fprintf(stderr, "Hardware counters are only supported on Linux\n");
+	return false;
+#endif
+}
+
+bool HardwareCounters::IsEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+bool HardwareCounters::IsRecordingThread()
+{
+	return isRecordingThread;
+}
+
+void HardwareCounters::RegisterCurrentThread()
+{
+#if defined(__linux__)
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	CountedThread thread{};
+	thread.threadId = currentThreadId();
+	r.threads.push_back(std::move(thread));
+	currentThread = &r.threads.back();
+	if (enabled)
+		openThread(*currentThread, false);
+#endif
+}
+
+void HardwareCounters::UnregisterCurrentThread()
+{
+#if defined(__linux__)
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	const pid_t threadId = currentThreadId();
+	const auto thread = std::find_if(r.threads.begin(), r.threads.end(), [&](const CountedThread& t) { return t.threadId == threadId; });
+	if (thread == r.threads.end())
+		return;
+	closeThread(*thread);
+	r.threads.erase(thread);
+	currentThread = nullptr;
+#endif
+}
+
+void HardwareCounters::Read(Sample& sample)
+{
+	ReadCurrentThread(sample);
+	for (int e = 0; e < EventCount; ++e)
+		sample.values[e] += workerTotals[e].load(std::memory_order_relaxed);
+}
+
+void HardwareCounters::ReadCurrentThread(Sample& sample)
+{
+	sample = Sample();
+#if defined(__linux__)
+	// Only the owning thread unregisters its entry, and Enable opens it before enabled is set.
+	if (currentThread)
+		readThread(*currentThread, sample);
+#endif
+}
+
+void HardwareCounters::AddWorkerWork(const Sample& begin, const Sample& end)
+{
+	for (int e = 0; e < EventCount; ++e)
+		workerTotals[e].fetch_add(std::max(0LL, end.values[e] - begin.values[e]), std::memory_order_relaxed);
+}
+
+void HardwareCounters::Record(const char* name, const Sample& begin, const Sample& end)
+{
+	Scope& scope = findOrAddScope(name);
+	for (int e = 0; e < EventCount; ++e)
+		scope.frameTotal.values[e] += std::max(0LL, end.values[e] - begin.values[e]);
+	scope.recordedThisFrame = true;
+}
+
+void HardwareCounters::EndFrame(int armyCount)
+{
+	if (!IsEnabled())
+		return;
+
+	std::vector<HardwareCountersSummary> frame;
+	for (int i = 0; i < scopeCount; ++i)
+	{
+		Scope& scope = scopes[i];
+		if (!scope.recordedThisFrame)
+			continue;
+
+		const Sample& total = scope.frameTotal;
+		const long long cycles = total.values[Cycles];
+		const long long instructions = total.values[Instructions];
+		frame.push_back({ scope.name, cycles, instructions,
+			isAvailable(Instructions) && cycles > 0 ? (float)instructions / (float)cycles : -1.0f,
+			perArmy(total, LlcMisses, armyCount),
+			perArmy(total, DtlbMisses, armyCount),
+			perArmy(total, BranchMisses, armyCount) });
+
+		scope.frameTotal = Sample();
+		scope.recordedThisFrame = false;
+	}
+
+	std::lock_guard<std::mutex> lock(publishedMutex);
+	published = std::move(frame);
+}
+
+std::vector<HardwareCountersSummary> HardwareCounters::GetFrame()
+{
+	std::lock_guard<std::mutex> lock(publishedMutex);
+	return published;
+}
+
+void HardwareCounters::Print(std::FILE* out)
+{
+	if (!IsEnabled())
+	{
+		std::fprintf(out, "Hardware counters are off, see --hw-counters\n");
+		return;
+	}
+
+	auto printRate = [&](float value)
+	{
+		if (value < 0.0f)
+			std::fprintf(out, " %10s", "n/a");
+		else
+			std::fprintf(out, " %10.3f", value);
+	};
+
+	std::fprintf(out, "%-52s %10s %10s %10s %10s %10s\n", "Hardware counters, last frame", "Mcycles", "IPC", "LLC/army", "dTLB/army", "branch/army");
+	for (const HardwareCountersSummary& s : GetFrame())
+	{
+		std::fprintf(out, "%-52s %10.3f", s.name, (double)s.cycles / 1e6);
+		printRate(s.instructionsPerCycle);
+		printRate(s.llcMissesPerArmy);
+		printRate(s.dtlbMissesPerArmy);
+		printRate(s.branchMissesPerArmy);
+		std::fprintf(out, "\n");
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+
+
+struct HardwareCountersSummary
+{
+	const char* name;
+	long long cycles;
+	long long instructions;
+	// Negative where the CPU or the kernel does not provide the event.
+	float instructionsPerCycle;
+	float llcMissesPerArmy;
+	float dtlbMissesPerArmy;
+	float branchMissesPerArmy;
+};
+
+/// Optional CPU performance counters per SYSTEM_SCOPE, from Linux perf_event_open:
+/// cycles, instructions, last level cache misses, data TLB misses and branch
+/// misses. Every pool worker and the thread that enables the counters gets a
+/// counter group. The enabling thread records the scopes: a scope counts that
+/// thread's own group plus what workers spend on the fork-join jobs it submits,
+/// so the work a system hands to parallelFor is included while background
+/// tasks and the drawing thread's jobs are not.
+///
+/// Each scope costs a read at either end and each of the recording thread's
+/// jobs a read per worker at either end, which is why this is off unless
+/// enabled. Counters are user space only, so they also work with
+/// perf_event_paranoid at 2. Recording and frames belong to the simulation thread.
+class HardwareCounters
+{
+public:
+	enum Event
+	{
+		Cycles,
+		Instructions,
+		LlcMisses,
+		DtlbMisses,
+		BranchMisses,
+		EventCount
+	};
+
+	struct Sample
+	{
+		long long values[EventCount] = {};
+	};
+
+	/// Opens the counters of the calling thread and of every registered thread.
+	/// Returns false, and stays disabled, where perf_event_open is unavailable or not permitted.
+	static bool Enable();
+	static bool IsEnabled();
+
+	/// True on the thread that enabled the counters, which records the scopes.
+	static bool IsRecordingThread();
+
+	/// Pool workers register when they start and unregister before they exit.
+	/// Before Enable this only remembers the thread.
+	static void RegisterCurrentThread();
+	static void UnregisterCurrentThread();
+
+	/// Running totals of the recording thread plus the worker time spent on its
+	/// jobs, scaled up for the time the kernel multiplexed a group off the CPU.
+	static void Read(Sample& sample);
+
+	/// A worker reads its own group around its share of a recording thread's
+	/// job and adds the difference, so the job's scope sees it.
+	static void ReadCurrentThread(Sample& sample);
+	static void AddWorkerWork(const Sample& begin, const Sample& end);
+
+	static void Record(const char* name, const Sample& begin, const Sample& end);
+
+	/// Turns the frame's totals into rates per system and publishes them.
+	static void EndFrame(int armyCount);
+
+	/// Rates of the last frame, in the order the systems first ran.
+	static std::vector<HardwareCountersSummary> GetFrame();
+	static void Print(std::FILE* out);
+};
+
+class HardwareCountersScope
+{
+public:
+	explicit HardwareCountersScope(const char* name)
+		: name(name), enabled(HardwareCounters::IsRecordingThread())
+	{
+		if (enabled)
+			HardwareCounters::Read(begin);
+	}
+
+	~HardwareCountersScope()
+	{
+		if (!enabled)
+			return;
+		HardwareCounters::Sample end;
+		HardwareCounters::Read(end);
+		HardwareCounters::Record(name, begin, end);
+	}
+
+private:
+	const char* name;
+	bool enabled;
+	HardwareCounters::Sample begin;
+};
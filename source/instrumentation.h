@@ -0,0 +1,15 @@
+#pragma once
+#include "frame_arena.h"
+#include "hardware_counters.h"
+#include "metrics.h"
+
+#define SYSTEM_SCOPE_CONCAT_IMPL(a, b) a##b
+#define SYSTEM_SCOPE_CONCAT(a, b) SYSTEM_SCOPE_CONCAT_IMPL(a, b)
+
+/// Per-system bookkeeping for a top-level system call on the simulation thread.
+/// Scopes are keyed by name, so pass a literal qualified with the system,
+/// such as "CombatSystem::KillArmies"; __FUNCTION__ drops the class on GCC and Clang.
+#define SYSTEM_SCOPE(name) \
+	FrameArenaScope SYSTEM_SCOPE_CONCAT(frameArenaScope, __LINE__)(name); \
+	MetricsScope SYSTEM_SCOPE_CONCAT(metricsScope, __LINE__)(name); \
+	HardwareCountersScope SYSTEM_SCOPE_CONCAT(hardwareCountersScope, __LINE__)(name)
@@ -0,0 +1,252 @@
+#include "large_pages.h"
+
+#include <algorithm>
+#include <mutex>
+#include <new>
+
+#include "thread_pool.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#endif
+
+
+namespace
+{
+	struct Region
+	{
+		char* pointer;
+		// Bytes mapped, rounded up to whole pages.
+		size_t mappedBytes;
+		bool explicitHugePages;
+		bool prefaulted;
+	};
+
+	LargePageConfig config;
+	std::mutex mutex;
+	std::vector<Region> regions;
+
+	size_t roundUp(size_t bytes, size_t multiple)
+	{
+		return (bytes + multiple - 1) / multiple * multiple;
+	}
+
+	void prefault(char* pointer, size_t bytes)
+	{
+		const size_t pageSize = 4096;
+		const size_t pageCount = (bytes + pageSize - 1) / pageSize;
+
+		ThreadPool& pool = ThreadPool::Get();
+		const int chunkCount = (int)std::min<size_t>(pageCount, (size_t)pool.GetThreadCount() * 4);
+		pool.Run(chunkCount, [&](int chunk)
+			{
+				const size_t begin = pageCount * chunk / chunkCount;
+				const size_t end = pageCount * (chunk + 1) / chunkCount;
+				for (size_t page = begin; page < end; ++page)
+					((volatile char*)pointer)[page * pageSize] = 0;
+			});
+	}
+
+#if defined(_WIN32)
+	bool enableLockMemoryPrivilege()
+	{
+		HANDLE token;
+		if (!OpenProcessToken(GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+			return false;
+
+		TOKEN_PRIVILEGES privileges{};
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+		const bool enabled = LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+			&& AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+			&& GetLastError() == ERROR_SUCCESS;
+		CloseHandle(token);
+		return enabled;
+	}
+
+	char* map(size_t bytes, size_t& mappedBytes, bool& explicitHugePages)
+	{
+		explicitHugePages = false;
+		if (config.explicitHugePages)
+		{
+			const size_t largePageSize = GetLargePageMinimum();
+			if (largePageSize > 0)
+			{
+				mappedBytes = roundUp(bytes, largePageSize);
+				void* pointer = VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (pointer)
+				{
+					explicitHugePages = true;
+					return (char*)pointer;
+				}
+			}
+		}
+
+		mappedBytes = bytes;
+		return (char*)VirtualAlloc(nullptr, mappedBytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+
+	void unmap(const Region& region)
+	{
+		VirtualFree(region.pointer, 0, MEM_RELEASE);
+	}
+#elif defined(__linux__)
+	char* map(size_t bytes, size_t& mappedBytes, bool& explicitHugePages)
+	{
+		mappedBytes = roundUp(bytes, LargePages::hugePageSize);
+
+		explicitHugePages = false;
+		if (config.explicitHugePages)
+		{
+			void* pointer = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+			if (pointer != MAP_FAILED)
+			{
+				explicitHugePages = true;
+				return (char*)pointer;
+			}
+		}
+
+		// Over-map by one huge page and trim, so the buffer starts on a huge page boundary.
+		const size_t reservedBytes = mappedBytes + LargePages::hugePageSize;
+		void* reserved = mmap(nullptr, reservedBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (reserved == MAP_FAILED)
+			return nullptr;
+
+		char* base = (char*)reserved;
+		char* pointer = (char*)roundUp((size_t)base, LargePages::hugePageSize);
+		if (pointer > base)
+			munmap(base, pointer - base);
+		if (base + reservedBytes > pointer + mappedBytes)
+			munmap(pointer + mappedBytes, base + reservedBytes - (pointer + mappedBytes));
+
+		if (config.hugePages)
+			madvise(pointer, mappedBytes, MADV_HUGEPAGE);
+		return pointer;
+	}
+
+	void unmap(const Region& region)
+	{
+		munmap(region.pointer, region.mappedBytes);
+	}
+
+	// Sums AnonHugePages of the mappings that overlap a live region.
+	size_t readTransparentHugePageBytes()
+	{
+		std::ifstream smaps("/proc/self/smaps");
+		std::string line;
+		bool overlaps = false;
+		size_t bytes = 0;
+		while (std::getline(smaps, line))
+		{
+			const size_t space = line.find(' ');
+			const std::string first = line.substr(0, space);
+			if (!first.empty() && first.back() == ':')
+			{
+				if (overlaps && first == "AnonHugePages:")
+					bytes += (size_t)std::stoull(line.substr(space)) * 1024;
+				continue;
+			}
+
+			// Mapping header: "begin-end perms offset device inode path".
+			const size_t dash = first.find('-');
+			if (dash == std::string::npos)
+				continue;
+
+			const size_t begin = (size_t)std::stoull(first.substr(0, dash), nullptr, 16);
+			const size_t end = (size_t)std::stoull(first.substr(dash + 1), nullptr, 16);
+			overlaps = std::any_of(regions.begin(), regions.end(), [&](const Region& region)
+				{
+					return !region.explicitHugePages && begin < (size_t)region.pointer + region.mappedBytes && end > (size_t)region.pointer;
+				});
+		}
+		return bytes;
+	}
+#endif
+}
+
+void LargePages::Configure(const LargePageConfig& newConfig)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	config = newConfig;
+
+#if defined(_WIN32)
+	if (config.explicitHugePages && !enableLockMemoryPrivilege())
+		config.explicitHugePages = false;
+#endif
+}
+
+void* LargePages::Allocate(size_t bytes)
+{
+	LargePageConfig currentConfig;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		currentConfig = config;
+	}
+
+#if defined(_WIN32) || defined(__linux__)
+	if (bytes >= currentConfig.minBytes)
+	{
+		Region region{};
+		region.pointer = map(bytes, region.mappedBytes, region.explicitHugePages);
+		if (!region.pointer)
+			throw std::bad_alloc();
+
+		if (currentConfig.prefault)
+		{
+			prefault(region.pointer, region.mappedBytes);
+			region.prefaulted = true;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		regions.push_back(region);
+		return region.pointer;
+	}
+#endif
+
+	return ::operator new(bytes, std::align_val_t(alignment));
+}
+
+void LargePages::Deallocate(void* pointer, size_t bytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto region = std::find_if(regions.begin(), regions.end(), [&](const Region& r) { return r.pointer == pointer; });
+		if (region != regions.end())
+		{
+#if defined(_WIN32) || defined(__linux__)
+			unmap(*region);
+#endif
+			regions.erase(region);
+			return;
+		}
+	}
+
+	::operator delete(pointer, bytes, std::align_val_t(alignment));
+}
+
+LargePageStats LargePages::GetStats()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	LargePageStats stats;
+	for (const Region& region : regions)
+	{
+		++stats.bufferCount;
+		stats.bytes += region.mappedBytes;
+		if (region.explicitHugePages)
+			stats.hugePageBytes += region.mappedBytes;
+		if (region.prefaulted)
+			stats.prefaultedBytes += region.mappedBytes;
+	}
+
+#if defined(__linux__)
+	stats.hugePageBytes += readTransparentHugePageBytes();
+#endif
+	return stats;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+
+struct LargePageConfig
+{
+	// Ask for transparent huge pages (madvise) on the large buffers.
+	bool hugePages = true;
+	// Try reserved huge pages first (MAP_HUGETLB, or MEM_LARGE_PAGES with the lock pages privilege).
+	bool explicitHugePages = false;
+	// Touch every page of a new large buffer on the pool threads, so the first frames do not fault.
+	bool prefault = false;
+	// Smaller buffers come from the heap, 64 byte aligned.
+	size_t minBytes = 1 << 20;
+};
+
+struct LargePageStats
+{
+	int bufferCount = 0;
+	// Bytes mapped, rounded up to whole pages.
+	size_t bytes = 0;
+	// Bytes actually backed by huge pages, as reported by the OS.
+	size_t hugePageBytes = 0;
+	size_t prefaultedBytes = 0;
+};
+
+/// Backing store for the world arrays that span the whole army range. Buffers
+/// are cache line aligned; large ones are mapped directly, aligned to the huge
+/// page size so the kernel can back them with huge pages, and optionally
+/// prefaulted in parallel.
+class LargePages
+{
+public:
+	static const size_t alignment = 64;
+	static const size_t hugePageSize = 2 << 20;
+
+	/// Applies to buffers allocated afterwards.
+	static void Configure(const LargePageConfig& config);
+
+	static void* Allocate(size_t bytes);
+	static void Deallocate(void* pointer, size_t bytes);
+
+	/// Live large buffers and how much of them the OS backs with huge pages.
+	static LargePageStats GetStats();
+};
+
+template<class T>
+class LargePageAllocator
+{
+public:
+	using value_type = T;
+
+	LargePageAllocator() = default;
+	template<class U>
+	LargePageAllocator(const LargePageAllocator<U>&) {}
+
+	T* allocate(size_t count) { return (T*)LargePages::Allocate(count * sizeof(T)); }
+	void deallocate(T* pointer, size_t count) { LargePages::Deallocate(pointer, count * sizeof(T)); }
+
+	template<class U>
+	bool operator==(const LargePageAllocator<U>&) const { return true; }
+	template<class U>
+	bool operator!=(const LargePageAllocator<U>&) const { return false; }
+};
+
+template<class T>
+using LargeVector = std::vector<T, LargePageAllocator<T>>;
@@ -5,218 +5,198 @@
 #include <time.h>
 
 #include "drawing.h"
+#include "event_stream.h"
+#include "metrics.h"
 #include "game_state.h"
-#include "parallel_for.h"
+#include "grid.h"
+#include "hardware_counters.h"
+#include "large_pages.h"
+#include "memory_report.h"
+#include "options.h"
+#include "periodic_task.h"
 #include "raylib.h"
 #include "raylib_extensions.h"
-#include "systems.h"
+#include "scaling_report.h"
+#include "simulation.h"
+#include "simulation_clock.h"
+#include "spectator_server.h"
+#include "stress_suite.h"
+#include "thread_pool.h"
 #include "optick.h"
 
 
-void main()
+int main(int argc, char** argv)
 {
-    std::srand((unsigned int)std::time(nullptr));
-
-    const int screenWidth = Constants::screenWidth;
-    const int screenHeight = Constants::screenHeight;
-
-    std::vector<Color> countryColors = generateRandomColors(Constants::maxCountries);
-
-
-    const float desiredFps = 60.0f;
-    const float frameBudgetInMs = 1000.0f / desiredFps;
-    const float desiredDeltaTimeInS = 1.0f / (float)desiredFps;
-    float actualFrameTimeInMs = 0.0f;
-
-    std::vector<Country> countries;
-    std::vector<Army> armies;
-    std::vector<Province> provinces;
-
-    countries.resize(Constants::maxCountries);
-    armies.resize(Constants::maxArmies);
-    const int provinceCount = Constants::screenWidth / Constants::provinceSize * Constants::screenHeight / Constants::provinceSize;
-    provinces.resize(provinceCount);
-
-    std::default_random_engine generator;
-    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
-    ShallowTest::Vector2 CountryPositions[Constants::maxCountries];
-    for (int i = 0; i < Constants::maxCountries; i++)
+    const AppOptions options = parseOptions(argc, argv);
+    ThreadPool::Configure(options.threadPool);
+    if (options.hardwareCounters)
+        HardwareCounters::Enable();
+    LargePages::Configure(options.largePages);
+    GridGeometry::Set(GridGeometry::FromProvinceSize(options.provinceSize));
+
+    if (options.scalingRunTicks > 0)
     {
-        CountryPositions[i] = { screenWidth / 2, screenHeight / 2 };
-        ShallowTest::Vector2 offset;
-        offset.x = distribution(generator) * (screenWidth / 2 - 150.0f);
-        offset.y = distribution(generator) * (screenHeight / 2 - 150.0f);
-        CountryPositions[i] = CountryPositions[i] + offset;
-
-        countries[i].position = CountryPositions[i];
-        provinces[ArmyToProvinceAssignmentSystem::GetProvinceIndexForPosition(CountryPositions[i])].countryIndex = i;
+        runScalingReport(options);
+        return 0;
     }
 
-    std::vector<ShallowTest::Vector2> armyVectors1; armyVectors1.resize(Constants::maxArmies);
-    std::vector<ShallowTest::Vector2> armyVectors2; armyVectors2.resize(Constants::maxArmies);
-    std::vector<float> armyFloats; armyFloats.resize(Constants::maxArmies);
-    std::vector<int> armyInts; armyInts.resize(Constants::maxArmies);
+    if (!options.stress.scenario.empty())
+        return runStressSuite(options);
 
-    std::vector<tArmyIndex> armyToProvinceAssignments;
-    std::vector<tArmyIndex> armyToCountryAssignments;
-    std::vector<tProvinceIndex> provinceToCountryAssignments;
+    if (options.threadPool.pinThreads)
+        ThreadPool::PinCurrentThread(options.threadPool.firstCore);
 
-    std::vector<tArmyIndex> validArmyIndices; validArmyIndices.resize(Constants::maxArmies);
-    std::iota(validArmyIndices.begin(), validArmyIndices.end(), 0);
-    const std::vector<tArmyIndex> armyIndicesAll = validArmyIndices;
-    validArmyIndices.resize(Constants::maxCountries * Constants::initialArmiesPerCountry);
+    std::srand((unsigned int)std::time(nullptr));
 
-    std::vector<tProvinceIndex> provinceIndices; provinceIndices.resize(provinces.size());
-    std::iota(provinceIndices.begin(), provinceIndices.end(), 0);
+    std::vector<Color> countryColors = generateRandomColors(options.countryCount);
 
-    std::vector<tCountryIndex> countryIndices; countryIndices.resize(Constants::maxCountries);
-    std::iota(countryIndices.begin(), countryIndices.end(), 0);
+    SimulationClock clock(options.clock);
 
-    std::vector<tArmyIndex> killedArmiesIndices;
-    std::vector<tArmyIndex> spawnedArmiesCountByCountry;
+    if (options.interleaveMemory)
+        ThreadPool::SetInterleavedMemory(true);
 
-    std::vector<int> left, top, right, bottom;
-    VectorFieldSystem::CreateDirections(provinceIndices, left, top, right, bottom);
+    Simulation simulation(clock.GetTickDeltaInS(), options.countryCount, options.lean);
+    simulation.governor.Configure(options.governor);
+    simulation.armySeparationEnabled = options.armySeparation;
+    simulation.navigationEnabled = options.navigation;
 
-    std::vector<float> pressure;
-    pressure.resize(provinceIndices.size());
+    if (options.interleaveMemory)
+        ThreadPool::SetInterleavedMemory(false);
 
-    std::vector<ShallowTest::Vector2> flow;
-    flow.resize(provinceIndices.size());
+    GameState drawingStateCopy{ 
+        std::cref(simulation.validArmyIndices), 
+        std::cref(simulation.armies), 
+        std::cref(simulation.countryIndices), 
+        std::cref(simulation.countries), 
+        std::cref(countryColors),
+        std::cref(simulation.provinceIndices), 
+        std::cref(simulation.provinces), 
+        std::cref(simulation.flow) 
+    };
 
-    int armiesPerCountry = Constants::initialArmiesPerCountry;
-    std::for_each(std::execution::par_unseq, countryIndices.begin(), countryIndices.end(), [&](int i)
-        {
-            const auto indices_slice = slice(validArmyIndices, i * armiesPerCountry, i * armiesPerCountry + armiesPerCountry - 1);
-            ArmySystem::SetCountryIndex(indices_slice, i, armies);
-            ArmySystem::SetValid(indices_slice, true, armies);
-            ArmySystem::SetHitPoints(indices_slice, Constants::armyInitialHitPoints, armies);
-            VectorSystem::RandomAround(indices_slice, CountryPositions[i], 150, armyVectors1);
-            ArmySystem::SetPosition(indices_slice, armyVectors1, armies);
-        });
+    MetricsConfig metricsConfig;
+    metricsConfig.jsonPath = options.metricsJsonPath;
+    metricsConfig.csvPath = options.metricsCsvPath;
+    if (metricsConfig.jsonPath.empty() && metricsConfig.csvPath.empty())
+        metricsConfig.exportIntervalInS = 0.0f;
+    Metrics::Configure(metricsConfig);
 
-    std::vector<int> armyIndiciesCopy;
-    std::vector<Army> armiesCopy;
-    armiesCopy.resize(Constants::maxArmies);
-    std::vector<Province> provincesCopy;
-    provincesCopy.resize(provinces.size());
+    // File I/O for the metrics runs on an idle pool thread instead of inside a tick.
+    PeriodicTask metricsExportTask(Metrics::ExportPublished, {}, metricsConfig.exportIntervalInS, "MetricsExport");
 
-    const char randomSetCount = 5;
-    std::vector<ShallowTest::Vector2> randomVectors[randomSetCount];
+    EventStreamConfig eventStreamConfig;
+    eventStreamConfig.path = options.eventLogPath;
+    EventStream::Configure(eventStreamConfig);
 
-    for (int i = 0; i < randomSetCount; ++i)
+    if (!options.spectatorSocketPath.empty() || options.spectatorPort > 0)
     {
-        randomVectors[i].resize(armyIndicesAll.size());
-        VectorSystem::RandomUnit(armyIndicesAll, randomVectors[i]);
+        SpectatorConfig spectatorConfig;
+        spectatorConfig.unixSocketPath = options.spectatorSocketPath;
+        spectatorConfig.tcpPort = options.spectatorPort;
+        SpectatorServer::Configure(spectatorConfig);
     }
 
-    char currentRandomSet = 0;
-
-    GameState drawingStateCopy{ 
-        std::cref(validArmyIndices), 
-        std::cref(armies), 
-        std::cref(countryIndices), 
-        std::cref(countries), 
-        std::cref(countryColors),
-        std::cref(provinceIndices), 
-        std::cref(provinces), 
-        std::cref(flow) 
-    };
-
     DrawingContext drawingContext;
     drawingContext.options = DrawingContext::Options::DrawVectorField;
+    if (options.densityMap)
+        drawingContext.options = (DrawingContext::Options)((int)drawingContext.options | (int)DrawingContext::Options::DrawDensity);
+    if (options.sprites)
+        drawingContext.options = (DrawingContext::Options)((int)drawingContext.options | (int)DrawingContext::Options::DrawSprites);
+    drawingContext.densityTileSize = options.densityTileSize;
+    drawingContext.sprites = options.spriteRenderer;
+    drawingContext.drawingFlag = 1;
+    drawingContext.copyStateFlag = 0;
+
+    MemoryReport::Track(&drawingContext, "Drawing", "armies", drawingContext.armies);
+    MemoryReport::Track(&drawingContext, "Drawing", "armyIndices", drawingContext.armyIndices);
+    MemoryReport::Track(&drawingContext, "Drawing", "provinces", drawingContext.provinces);
+    MemoryReport::Track(&drawingContext, "Drawing", "flow", drawingContext.flow);
+    MemoryReport::Track(&drawingContext, "Drawing", "countries", drawingContext.countries);
+    MemoryReport::Track(&drawingContext, "Drawing", "countryColors", countryColors);
+    MemoryReport::Print(stdout);
+
+    // Resident set size as metrics, so the peak shows up in the export. The /proc
+    // reads run on an idle pool thread; only the Metrics update runs in the tick.
+    size_t residentBytes = 0;
+    size_t peakResidentBytes = 0;
+    PeriodicTask memoryStatsTask([&]()
+        {
+            residentBytes = MemoryReport::GetResidentBytes();
+            peakResidentBytes = MemoryReport::GetPeakResidentBytes();
+        },
+        [&]()
+        {
+            Metrics::Set("Memory.ResidentInMB", (long long)(residentBytes >> 20));
+            Metrics::Set("Memory.PeakResidentInMB", (long long)(peakResidentBytes >> 20));
+        }, 1.0f, "MemoryStats");
 
     std::thread drawingThread([&]()
         {
             mainDraw(drawingStateCopy, drawingContext);
         });
 
-    PeriodicTask spawnTask([&]{ SpawnSystem::Spawn(validArmyIndices, armies, countryIndices, countries, desiredDeltaTimeInS, spawnedArmiesCountByCountry); }, 0.01f);
-    float timePassed = 0.0f;
     float mouseInteractionRadius = (float)Constants::interactionRadius;
+    bool fastForwardKeyDown = false;
+    bool memoryReportKeyDown = false;
+    bool hardwareCountersKeyDown = false;
 
     while (true)
     {
         OPTICK_FRAME("Main Thread");
-        drawingContext.drawingFlag = 1;
-
-        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
-
-        const bool spaceDown = IsKeyDown(KEY_SPACE);
 
-        if (!spaceDown)
+        const bool fastForwardDown = IsKeyDown(KEY_F);
+        if (fastForwardDown && !fastForwardKeyDown)
+            clock.SetFastForward(!clock.IsFastForward());
+        fastForwardKeyDown = fastForwardDown;
+
+        // The drawing thread only resizes the copied state during the copy below, and
+        // reports its own buffers as byte counts snapshotted after each frame, so the report is safe here.
+        const bool memoryReportDown = IsKeyDown(KEY_M);
+        if (memoryReportDown && !memoryReportKeyDown)
+            MemoryReport::Print(stdout);
+        memoryReportKeyDown = memoryReportDown;
+
+        const bool hardwareCountersDown = IsKeyDown(KEY_C);
+        if (hardwareCountersDown && !hardwareCountersKeyDown)
+            HardwareCounters::Print(stdout);
+        hardwareCountersKeyDown = hardwareCountersDown;
+
+        const int ticks = clock.Advance(IsKeyDown(KEY_SPACE));
+        for (int tick = 0; tick < ticks; ++tick)
         {
-            ArmySystem::MergeKilledAndSpawned(armyIndicesAll, validArmyIndices, armies, countries, killedArmiesIndices, spawnedArmiesCountByCountry);
-
-            ArmySystem::InitializeIndices(armyIndicesAll, validArmyIndices, armies);
-
-            SpawnSystem::UpdateFactor(countryIndices, countries, desiredDeltaTimeInS);
-
-            std::vector<std::vector<int>> armiesPerProvincePerThread;
-            ArmyToProvinceAssignmentSystem::AssignArmies(provinceIndices, provinces, validArmyIndices, armies, armyToProvinceAssignments, armiesPerProvincePerThread, armyInts);
-
-            std::thread cleanup([&]()
-                {
-                    auto releasee = std::move(armiesPerProvincePerThread);
-                    releasee.clear();
-                });
-
-            ProvinceToCountryAssignmentSystem::AssignProvinces(countryIndices, countries, provinceIndices, provinces, provinceToCountryAssignments);
-            ArmyToCountryAssignmentSystem::AssignArmies(countryIndices, countries, validArmyIndices, armies);
-
-            ArmySystem::CalcPositionFromFlow(validArmyIndices, armies, flow, randomVectors[currentRandomSet], desiredDeltaTimeInS);
-            CountrySystem::CalcPositionFromFlow(countryIndices, countries, flow, randomVectors[currentRandomSet], desiredDeltaTimeInS);
-
             Vector2 mousePos = GetMousePosition();
             mouseInteractionRadius = std::clamp(mouseInteractionRadius + GetMouseWheelMove() * 5.0f, (float)Constants::minInteractionRadius, (float)Constants::maxInteractionRadius);
 
-            {
-                OPTICK_EVENT("Wait for drawing");
-                // Wait for drawing thread
-                while (drawingContext.drawingFlag)
-                    std::this_thread::yield();
-
-                drawingContext.interactionRadius = mouseInteractionRadius;
-                drawingContext.copyStateFlag = 1;
-            }           
-
-            CombatSystem::DamageArmies(validArmyIndices, armies, provinces);
-            if (IsMouseButtonDown(1))
-                CombatSystem::DamageArmiesWithinRadius(validArmyIndices, armies, { mousePos.x, mousePos.y }, mouseInteractionRadius);
-    
-            CombatSystem::KillArmies(validArmyIndices, armies, killedArmiesIndices);
-            spawnTask.update(desiredDeltaTimeInS);
-            
-            if (IsMouseButtonDown(0))
-                VectorFieldSystem::CreatePressure(provinceIndices, provinces, { mousePos.x, mousePos.y }, mouseInteractionRadius, pressure);
-            else
-                VectorFieldSystem::ClearPressure(provinceIndices, provinces, pressure);
-
-            VectorFieldSystem::CreateFlow(provinceIndices, left, top, right, bottom, pressure, flow, timePassed);
-
-            cleanup.join();
-        }
-        else
-        {
-            OPTICK_EVENT("Wait for drawing");
-            // Wait for drawing thread
-            while (drawingContext.drawingFlag)
-                std::this_thread::yield();
-
-            drawingContext.copyStateFlag = 1;
+            TickInput input;
+            input.mousePosition = { mousePos.x, mousePos.y };
+            input.interactionRadius = mouseInteractionRadius;
+            input.killWithinRadius = IsMouseButtonDown(1);
+            input.pushWithinRadius = IsMouseButtonDown(0);
+
+            simulation.Tick(input);
+            clock.TickCompleted();
+            SpectatorServer::TryPublish(simulation);
+            memoryStatsTask.update(clock.GetTickDeltaInS());
+            if (metricsConfig.exportIntervalInS > 0.0f)
+                metricsExportTask.update(clock.GetTickDeltaInS());
         }
 
-
+        // Hand the newest completed tick to the drawing thread if it is done with the previous one.
+        // A slow renderer skips ticks instead of slowing the simulation down.
+        if (!drawingContext.drawingFlag)
         {
             OPTICK_EVENT("Wait for copy");
+            drawingContext.interactionRadius = mouseInteractionRadius;
+            drawingContext.copyStateFlag = 1;
             while (drawingContext.copyStateFlag)
                 std::this_thread::yield();
-        }
 
-        std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
-        actualFrameTimeInMs = (float)std::chrono::duration_cast<std::chrono::milliseconds> (end - begin).count();
-        timePassed += actualFrameTimeInMs;
+            // Metrics belong to this thread, so the drawing thread's statistics are published from here.
+            publishDrawingStats(drawingContext);
+            drawingContext.drawingFlag = 1;
+        }
 
-        currentRandomSet = (std::rand() % randomSetCount);
+        if (ticks == 0)
+            clock.WaitForNextTick();
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,172 @@
+#include "memory_report.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+#include "frame_arena.h"
+#include "large_pages.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__linux__)
+#include <fstream>
+#include <string>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+
+namespace
+{
+	struct TrackedBuffer
+	{
+		const void* owner;
+		const char* subsystem;
+		const char* name;
+		std::function<size_t()> bytes;
+	};
+
+	std::mutex mutex;
+	std::vector<TrackedBuffer> buffers;
+
+#if defined(__linux__)
+	// Reads a "<field>: <n> kB" line of /proc/self/status.
+	size_t readStatusInBytes(const char* field)
+	{
+		std::ifstream status("/proc/self/status");
+		std::string line;
+		const size_t fieldLength = std::strlen(field);
+		while (std::getline(status, line))
+		{
+			if (line.compare(0, fieldLength, field) == 0 && line.size() > fieldLength && line[fieldLength] == ':')
+				return (size_t)std::stoull(line.substr(fieldLength + 1)) * 1024;
+		}
+		return 0;
+	}
+#endif
+
+	double toMB(size_t bytes)
+	{
+		return (double)bytes / (1024.0 * 1024.0);
+	}
+}
+
+void MemoryReport::Track(const void* owner, const char* subsystem, const char* name, std::function<size_t()> bytes)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	buffers.push_back({ owner, subsystem, name, std::move(bytes) });
+}
+
+void MemoryReport::Untrack(const void* owner)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	buffers.erase(std::remove_if(buffers.begin(), buffers.end(), [&](const TrackedBuffer& buffer) { return buffer.owner == owner; }), buffers.end());
+}
+
+std::vector<MemoryEntry> MemoryReport::Collect()
+{
+	std::vector<MemoryEntry> entries;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (const TrackedBuffer& buffer : buffers)
+			entries.push_back({ buffer.subsystem, buffer.name, buffer.bytes() });
+	}
+
+	entries.push_back({ "FrameArena", "blocks", FrameArena::GetReservedBytes() });
+	return entries;
+}
+
+size_t MemoryReport::GetResidentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+#elif defined(__linux__)
+	return readStatusInBytes("VmRSS");
+#else
+	return 0;
+#endif
+}
+
+size_t MemoryReport::GetPeakResidentBytes()
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS counters;
+	return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#elif defined(__linux__)
+	return readStatusInBytes("VmHWM");
+#else
+	// ru_maxrss is in bytes on macOS.
+	rusage usage;
+	return getrusage(RUSAGE_SELF, &usage) == 0 ? (size_t)usage.ru_maxrss : 0;
+#endif
+}
+
+bool MemoryReport::ResetPeakResidentBytes()
+{
+#if defined(__linux__)
+#if defined(__GLIBC__)
+	malloc_trim(0);
+#endif
+	// 5 resets VmHWM to the current VmRSS, see proc(5).
+	std::ofstream clearRefs("/proc/self/clear_refs");
+	clearRefs << "5";
+	clearRefs.flush();
+	return clearRefs.good();
+#else
+	return false;
+#endif
+}
+
+void MemoryReport::Print(std::FILE* out)
+{
+	const std::vector<MemoryEntry> entries = Collect();
+
+	// Subsystems in order of first appearance, each followed by its buffers.
+	std::vector<const char*> subsystems;
+	for (const MemoryEntry& entry : entries)
+	{
+		if (std::none_of(subsystems.begin(), subsystems.end(), [&](const char* s) { return std::strcmp(s, entry.subsystem) == 0; }))
+			subsystems.push_back(entry.subsystem);
+	}
+
+	size_t trackedBytes = 0;
+	std::fprintf(out, "Memory report (MB)\n");
+	for (const char* subsystem : subsystems)
+	{
+		size_t subsystemBytes = 0;
+		for (const MemoryEntry& entry : entries)
+		{
+			if (std::strcmp(entry.subsystem, subsystem) == 0)
+				subsystemBytes += entry.bytes;
+		}
+		trackedBytes += subsystemBytes;
+
+		std::fprintf(out, "  %-34s %10.2f\n", subsystem, toMB(subsystemBytes));
+		for (const MemoryEntry& entry : entries)
+		{
+			if (std::strcmp(entry.subsystem, subsystem) == 0 && entry.bytes > 0)
+				std::fprintf(out, "    %-32s %10.2f\n", entry.name, toMB(entry.bytes));
+		}
+	}
+
+	const size_t residentBytes = GetResidentBytes();
+	std::fprintf(out, "  %-34s %10.2f\n", "Tracked", toMB(trackedBytes));
+	std::fprintf(out, "  %-34s %10.2f\n", "Resident", toMB(residentBytes));
+	std::fprintf(out, "  %-34s %10.2f\n", "Peak resident", toMB(GetPeakResidentBytes()));
+	if (residentBytes > trackedBytes)
+		std::fprintf(out, "  %-34s %10.2f\n", "Untracked resident", toMB(residentBytes - trackedBytes));
+
+	const LargePageStats largePages = LargePages::GetStats();
+	std::fprintf(out, "  %-34s %10.2f\n", "Large buffers", toMB(largePages.bytes));
+	std::fprintf(out, "    %-32s %10.2f\n", "backed by huge pages", toMB(largePages.hugePageBytes));
+	std::fprintf(out, "    %-32s %10.2f\n", "prefaulted", toMB(largePages.prefaultedBytes));
+	std::fflush(out);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+
+struct MemoryEntry
+{
+	const char* subsystem;
+	const char* name;
+	size_t bytes;
+};
+
+/// Registry of the long-lived buffers, tagged by subsystem. Owners track their
+/// buffers once and untrack them when destroyed; sizes are read when a report
+/// is collected, so growth after tracking is included.
+/// Collect from a thread that does not race with resizes of the tracked buffers.
+class MemoryReport
+{
+public:
+	template<class T, class Allocator>
+	static void Track(const void* owner, const char* subsystem, const char* name, const std::vector<T, Allocator>& buffer)
+	{
+		Track(owner, subsystem, name, [&buffer]() { return buffer.capacity() * sizeof(T); });
+	}
+
+	static void Track(const void* owner, const char* subsystem, const char* name, std::function<size_t()> bytes);
+	static void Untrack(const void* owner);
+
+	/// Current size of every tracked buffer, in tracking order.
+	static std::vector<MemoryEntry> Collect();
+
+	/// Resident set size of the process and its peak so far; 0 where unsupported.
+	static size_t GetResidentBytes();
+	static size_t GetPeakResidentBytes();
+
+	/// Hands freed heap memory back to the OS where the allocator allows it, then
+	/// restarts the peak from the current resident size. Linux only; returns false
+	/// where the peak cannot be reset.
+	static bool ResetPeakResidentBytes();
+
+	/// Bytes per subsystem and per buffer, and how much of the resident set they explain.
+	static void Print(std::FILE* out);
+};
@@ -0,0 +1,251 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+
+namespace
+{
+	struct Series
+	{
+		const char* name = nullptr;
+		std::vector<long long> samples;
+		int next = 0;
+		int count = 0;
+		long long frameTotal = 0;
+		bool recordedThisFrame = false;
+
+		void push(long long value, int window)
+		{
+			if ((int)samples.size() != window)
+			{
+				samples.assign(window, 0);
+				next = 0;
+				count = 0;
+			}
+
+			samples[next] = value;
+			next = (next + 1) % window;
+			count = std::min(count + 1, window);
+		}
+
+		MetricsSummary summarize() const
+		{
+			MetricsSummary summary{ name, 0.0f, 0.0f, 0.0f, 0.0f };
+			if (count == 0)
+				return summary;
+
+			std::vector<long long> sorted(samples.begin(), samples.begin() + count);
+			auto percentile = [&](float p)
+			{
+				const int index = std::min(count - 1, (int)std::ceil(p * count) - 1);
+				std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+				return (float)sorted[index] / 1e6f;
+			};
+
+			summary.p50InMs = percentile(0.50f);
+			summary.p95InMs = percentile(0.95f);
+			summary.p99InMs = percentile(0.99f);
+			summary.maxInMs = (float)*std::max_element(sorted.begin(), sorted.end()) / 1e6f;
+			return summary;
+		}
+	};
+
+	const int maxSeries = 64;
+	const int maxCounters = 64;
+	const int summaryRefreshInFrames = 30;
+
+	MetricsConfig config;
+
+	// Series 0 and 1 are the frame time and the frame jitter.
+	std::array<Series, maxSeries> series;
+	int seriesCount = 2;
+
+	std::array<MetricsCounter, maxCounters> counters;
+	int counterCount = 0;
+
+	std::chrono::steady_clock::time_point frameBegin;
+	long long previousFrameTime = -1;
+	long long frameIndex = 0;
+
+	std::mutex summaryMutex;
+	std::vector<MetricsSummary> publishedSummary;
+	std::vector<MetricsCounter> publishedCounters;
+	long long publishedFrameIndex = 0;
+
+	// Only one export writes to the files at a time.
+	std::mutex exportMutex;
+
+	Series& findOrAddSeries(const char* name)
+	{
+		for (int i = 2; i < seriesCount; ++i)
+		{
+			if (series[i].name == name || std::strcmp(series[i].name, name) == 0)
+				return series[i];
+		}
+
+		if (seriesCount == maxSeries)
+			return series[maxSeries - 1];
+
+		series[seriesCount].name = name;
+		return series[seriesCount++];
+	}
+
+	void exportSummary(long long frame, const std::vector<MetricsSummary>& summary, const std::vector<MetricsCounter>& counterValues)
+	{
+		if (!config.jsonPath.empty())
+		{
+			std::ofstream json(config.jsonPath, std::ios::app);
+			json << "{\"frame\":" << frame << ",\"series\":[";
+			for (size_t i = 0; i < summary.size(); ++i)
+			{
+				const MetricsSummary& s = summary[i];
+				json << (i == 0 ? "" : ",") << "{\"name\":\"" << s.name << "\",\"p50\":" << s.p50InMs << ",\"p95\":" << s.p95InMs
+					<< ",\"p99\":" << s.p99InMs << ",\"max\":" << s.maxInMs << "}";
+			}
+			json << "],\"counters\":{";
+			for (size_t i = 0; i < counterValues.size(); ++i)
+			{
+				json << (i == 0 ? "" : ",") << "\"" << counterValues[i].name << "\":" << counterValues[i].value;
+			}
+			json << "}}\n";
+		}
+
+		// Counters go into the p50 column, the other columns stay empty.
+		if (!config.csvPath.empty())
+		{
+			std::ofstream csv(config.csvPath, std::ios::app);
+			for (const MetricsSummary& s : summary)
+			{
+				csv << frame << "," << s.name << "," << s.p50InMs << "," << s.p95InMs << "," << s.p99InMs << "," << s.maxInMs << "\n";
+			}
+			for (const MetricsCounter& c : counterValues)
+			{
+				csv << frame << "," << c.name << "," << c.value << ",,,\n";
+			}
+		}
+	}
+
+	MetricsCounter& findOrAddCounter(const char* name)
+	{
+		for (int i = 0; i < counterCount; ++i)
+		{
+			if (counters[i].name == name || std::strcmp(counters[i].name, name) == 0)
+				return counters[i];
+		}
+
+		if (counterCount == maxCounters)
+			return counters[maxCounters - 1];
+
+		counters[counterCount] = { name, 0 };
+		return counters[counterCount++];
+	}
+
+	std::vector<MetricsSummary> summarizeAll()
+	{
+		std::vector<MetricsSummary> summary;
+		for (int i = 0; i < seriesCount; ++i)
+		{
+			if (series[i].count > 0)
+				summary.push_back(series[i].summarize());
+		}
+		return summary;
+	}
+}
+
+void Metrics::Configure(const MetricsConfig& newConfig)
+{
+	config = newConfig;
+}
+
+void Metrics::BeginFrame()
+{
+	series[0].name = "Frame";
+	series[1].name = "FrameJitter";
+	frameBegin = std::chrono::steady_clock::now();
+}
+
+void Metrics::EndFrame()
+{
+	const auto frameEnd = std::chrono::steady_clock::now();
+	const long long frameTime = std::chrono::duration_cast<std::chrono::nanoseconds>(frameEnd - frameBegin).count();
+
+	series[0].push(frameTime, config.windowInFrames);
+	if (previousFrameTime >= 0)
+		series[1].push(std::abs(frameTime - previousFrameTime), config.windowInFrames);
+	previousFrameTime = frameTime;
+
+	for (int i = 2; i < seriesCount; ++i)
+	{
+		if (series[i].recordedThisFrame)
+		{
+			series[i].push(series[i].frameTotal, config.windowInFrames);
+			series[i].frameTotal = 0;
+			series[i].recordedThisFrame = false;
+		}
+	}
+
+	++frameIndex;
+
+	if (frameIndex % summaryRefreshInFrames == 0)
+	{
+		std::vector<MetricsSummary> summary = summarizeAll();
+
+		std::lock_guard<std::mutex> lock(summaryMutex);
+		publishedSummary = std::move(summary);
+		publishedCounters.assign(counters.begin(), counters.begin() + counterCount);
+		publishedFrameIndex = frameIndex;
+	}
+}
+
+void Metrics::Record(const char* name, long long durationInNs)
+{
+	Series& s = findOrAddSeries(name);
+	s.frameTotal += durationInNs;
+	s.recordedThisFrame = true;
+}
+
+void Metrics::Count(const char* name, long long amount)
+{
+	findOrAddCounter(name).value += amount;
+}
+
+void Metrics::Set(const char* name, long long value)
+{
+	findOrAddCounter(name).value = value;
+}
+
+std::vector<MetricsSummary> Metrics::GetSummary()
+{
+	std::lock_guard<std::mutex> lock(summaryMutex);
+	return publishedSummary;
+}
+
+std::vector<MetricsCounter> Metrics::GetCounters()
+{
+	std::lock_guard<std::mutex> lock(summaryMutex);
+	return publishedCounters;
+}
+
+void Metrics::ExportPublished()
+{
+	std::vector<MetricsSummary> summary;
+	std::vector<MetricsCounter> counterValues;
+	long long frame;
+	{
+		std::lock_guard<std::mutex> lock(summaryMutex);
+		summary = publishedSummary;
+		counterValues = publishedCounters;
+		frame = publishedFrameIndex;
+	}
+
+	if (summary.empty())
+		return;
+
+	std::lock_guard<std::mutex> lock(exportMutex);
+	exportSummary(frame, summary, counterValues);
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+
+struct MetricsSummary
+{
+	const char* name;
+	float p50InMs;
+	float p95InMs;
+	float p99InMs;
+	float maxInMs;
+};
+
+struct MetricsCounter
+{
+	const char* name;
+	long long value;
+};
+
+struct MetricsConfig
+{
+	// Number of frames kept per series for the percentiles.
+	int windowInFrames = 600;
+	// How often the owner of the export task appends summaries to the files; 0 disables export.
+	float exportIntervalInS = 5.0f;
+	// Empty path disables that format; both are off unless asked for.
+	std::string jsonPath;
+	std::string csvPath;
+};
+
+/// Rolling per-system timing. Every SYSTEM_SCOPE adds its duration to the current
+/// frame; at the end of the frame the totals go into a ring buffer per system,
+/// together with the frame time and frame jitter (change from the previous frame).
+/// Counters are running totals of events such as overruns, or current values
+/// such as a degradation level.
+/// Recording happens on the simulation thread only; summaries can be read and
+/// exported from any thread.
+class Metrics
+{
+public:
+	static void Configure(const MetricsConfig& config);
+
+	static void BeginFrame();
+	static void EndFrame();
+
+	static void Record(const char* name, long long durationInNs);
+	static void Count(const char* name, long long amount = 1);
+	static void Set(const char* name, long long value);
+
+	/// Percentiles published at the last refresh, frame time and jitter first.
+	static std::vector<MetricsSummary> GetSummary();
+	static std::vector<MetricsCounter> GetCounters();
+
+	/// Appends the last published summary and counters to the configured files.
+	/// Does file I/O, so it belongs on a background thread.
+	static void ExportPublished();
+};
+
+class MetricsScope
+{
+public:
+	explicit MetricsScope(const char* name)
+		: name(name), begin(std::chrono::steady_clock::now())
+	{}
+
+	~MetricsScope()
+	{
+		Metrics::Record(name, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count());
+	}
+
+private:
+	const char* name;
+	std::chrono::steady_clock::time_point begin;
+};
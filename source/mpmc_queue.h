@@ -0,0 +1,95 @@
+#pragma once
+#include <assert.h>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+
+/// Bounded lock-free queue for any number of producers and consumers
+/// (Vyukov's sequence-numbered ring). Push and pop never block; they fail
+/// when the queue is full or empty instead.
+template<class T>
+class MpmcQueue
+{
+public:
+	/// Capacity must be a power of two.
+	explicit MpmcQueue(std::size_t capacity)
+		: cells(new Cell[capacity])
+		, mask(capacity - 1)
+	{
+		assert(capacity >= 2 && (capacity & mask) == 0);
+		for (std::size_t i = 0; i < capacity; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	MpmcQueue(const MpmcQueue&) = delete;
+	MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+	std::size_t GetCapacity() const { return mask + 1; }
+
+	bool TryPush(const T& value)
+	{
+		Cell* cell;
+		std::size_t position = enqueuePosition.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &cells[position & mask];
+			const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+
+			if (difference == 0)
+			{
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+				return false;
+			else
+				position = enqueuePosition.load(std::memory_order_relaxed);
+		}
+
+		cell->value = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool TryPop(T& value)
+	{
+		Cell* cell;
+		std::size_t position = dequeuePosition.load(std::memory_order_relaxed);
+		while (true)
+		{
+			cell = &cells[position & mask];
+			const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			const std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(position + 1);
+
+			if (difference == 0)
+			{
+				if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+				return false;
+			else
+				position = dequeuePosition.load(std::memory_order_relaxed);
+		}
+
+		value = cell->value;
+		cell->sequence.store(position + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	struct Cell
+	{
+		std::atomic<std::size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	const std::size_t mask;
+
+	// Producers and consumers spin on different cache lines.
+	alignas(64) std::atomic<std::size_t> enqueuePosition = 0;
+	alignas(64) std::atomic<std::size_t> dequeuePosition = 0;
+};
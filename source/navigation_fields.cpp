@@ -0,0 +1,274 @@
+#include "navigation_fields.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <thread>
+
+#include "grid.h"
+#include "metrics.h"
+#include "optick.h"
+#include "thread_pool.h"
+
+
+struct NavigationFields::Refresh
+{
+	std::vector<short> owners;
+	std::vector<int> hubs;
+	std::vector<int> countryIndices;
+	// One field per entry of countryIndices.
+	std::vector<NavigationDirection> fields;
+	std::atomic<int> remainingBatches = 0;
+	std::chrono::steady_clock::time_point begin;
+};
+
+NavigationFields::NavigationFields(int countryCount, const std::vector<int>& left, const std::vector<int>& top,
+	const std::vector<int>& right, const std::vector<int>& bottom, const NavigationConfig& config)
+	: config(config)
+	, countryCount(countryCount)
+	, provinceCount(GridGeometry::Get().GetProvinceCount())
+	, left(left)
+	, top(top)
+	, right(right)
+	, bottom(bottom)
+	, progress(config.refreshIntervalInS)
+{}
+
+NavigationFields::~NavigationFields()
+{
+	if (inFlight)
+	{
+		while (inFlight->remainingBatches.load(std::memory_order_acquire) > 0)
+			std::this_thread::yield();
+	}
+}
+
+void NavigationFields::Update(float deltaT, const std::vector<Province>& provinces, const std::vector<Country>& countries)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	if (inFlight && inFlight->remainingBatches.load(std::memory_order_acquire) == 0)
+		publish();
+
+	// The first refresh is due right away.
+	progress += deltaT;
+	if (progress < config.refreshIntervalInS)
+		return;
+
+	progress -= config.refreshIntervalInS;
+	if (inFlight)
+	{
+		Metrics::Count("NavigationFields.Overruns");
+		return;
+	}
+
+	start(provinces, countries);
+
+	// Without workers the batches ran inline.
+	if (inFlight && inFlight->remainingBatches.load(std::memory_order_acquire) == 0)
+		publish();
+}
+
+void NavigationFields::Complete()
+{
+	if (!inFlight)
+		return;
+
+	while (inFlight->remainingBatches.load(std::memory_order_acquire) > 0)
+		std::this_thread::yield();
+	publish();
+}
+
+void NavigationFields::start(const std::vector<Province>& provinces, const std::vector<Country>& countries)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	auto refresh = std::make_shared<Refresh>();
+	refresh->begin = std::chrono::steady_clock::now();
+	refresh->owners.resize(provinceCount);
+	for (int i = 0; i < provinceCount; ++i)
+		refresh->owners[i] = provinces[i].countryIndex;
+
+	const GridGeometry& grid = GridGeometry::Get();
+	refresh->hubs.resize(countryCount);
+	for (int i = 0; i < countryCount; ++i)
+		refresh->hubs[i] = grid.GetProvinceIndexForPosition(countries[i].position);
+
+	// A field depends on the owners of the country's provinces and of their neighbours,
+	// so an owner change dirties the old and new owner and the owners next to it.
+	// Countries without provinces head for their hub, so a moved hub dirties them too.
+	// Paths of other countries through the changed province keep the old step cost
+	// until their own border changes, which only shifts their fields slightly.
+	std::vector<char> dirty(countryCount, lastOwners.empty());
+	if (!lastOwners.empty())
+	{
+		auto markOwner = [&](int province)
+		{
+			if (province >= 0 && refresh->owners[province] >= 0)
+				dirty[refresh->owners[province]] = 1;
+		};
+
+		for (int i = 0; i < provinceCount; ++i)
+		{
+			if (refresh->owners[i] == lastOwners[i])
+				continue;
+
+			if (lastOwners[i] >= 0)
+				dirty[lastOwners[i]] = 1;
+			markOwner(i);
+			markOwner(left[i]);
+			markOwner(top[i]);
+			markOwner(right[i]);
+			markOwner(bottom[i]);
+		}
+
+		for (int i = 0; i < countryCount; ++i)
+		{
+			if (countries[i].provinceCount == 0 && refresh->hubs[i] != lastHubs[i])
+				dirty[i] = 1;
+		}
+	}
+
+	lastOwners = refresh->owners;
+	lastHubs = refresh->hubs;
+
+	for (int i = 0; i < countryCount; ++i)
+	{
+		if (dirty[i])
+			refresh->countryIndices.push_back(i);
+	}
+
+	const int fieldCount = (int)refresh->countryIndices.size();
+	if (fieldCount == 0)
+		return;
+
+	refresh->fields.resize((size_t)fieldCount * provinceCount);
+
+	// A few batches per thread, so a slow batch does not hold up the refresh.
+	const int batchCount = std::min(fieldCount, ThreadPool::Get().GetThreadCount() * 4);
+	refresh->remainingBatches = batchCount;
+	inFlight = refresh;
+
+	for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+	{
+		ThreadPool::Get().Submit([this, refresh, batchIndex, batchCount, fieldCount]()
+			{
+				OPTICK_EVENT("NavigationFields::Build");
+				for (int field = batchIndex; field < fieldCount; field += batchCount)
+					buildField(*refresh, refresh->countryIndices[field], refresh->fields.data() + (size_t)field * provinceCount);
+
+				refresh->remainingBatches.fetch_sub(1, std::memory_order_release);
+			});
+	}
+}
+
+void NavigationFields::publish()
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	directions.resize((size_t)countryCount * provinceCount);
+	const std::vector<int>& countryIndices = inFlight->countryIndices;
+	for (int field = 0; field < (int)countryIndices.size(); ++field)
+	{
+		std::copy_n(inFlight->fields.begin() + (size_t)field * provinceCount, provinceCount,
+			directions.begin() + (size_t)countryIndices[field] * provinceCount);
+	}
+
+	Metrics::Record("NavigationFields.Latency", std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - inFlight->begin).count());
+	Metrics::Count("NavigationFields.Recomputed", (long long)countryIndices.size());
+	inFlight.reset();
+}
+
+void NavigationFields::buildField(const Refresh& refresh, int countryIndex, NavigationDirection* output) const
+{
+	const std::vector<short>& owners = refresh.owners;
+
+	// Dial's algorithm: with integer step costs up to maxCost, maxCost + 1 buckets
+	// used round robin keep the queue ordered in O(provinces).
+	const int maxCost = std::max({ config.ownCost, config.neutralCost, config.enemyCost });
+	const int bucketCount = maxCost + 1;
+
+	thread_local std::vector<int> distance;
+	thread_local std::vector<std::vector<int>> buckets;
+	distance.assign(provinceCount, INT_MAX);
+	buckets.resize(bucketCount);
+	for (std::vector<int>& bucket : buckets)
+		bucket.clear();
+
+	int pending = 0;
+	auto push = [&](int province, int provinceDistance)
+	{
+		distance[province] = provinceDistance;
+		buckets[provinceDistance % bucketCount].push_back(province);
+		++pending;
+	};
+
+	auto ownedBy = [&](int province)
+	{
+		return province >= 0 && owners[province] == countryIndex;
+	};
+
+	for (int i = 0; i < provinceCount; ++i)
+	{
+		if (owners[i] != countryIndex && (ownedBy(left[i]) || ownedBy(top[i]) || ownedBy(right[i]) || ownedBy(bottom[i])))
+			push(i, 0);
+	}
+
+	if (pending == 0)
+		push(refresh.hubs[countryIndex], 0);
+
+	auto relax = [&](int province, int fromDistance)
+	{
+		if (province < 0)
+			return;
+
+		const int owner = owners[province];
+		const int cost = owner == countryIndex ? config.ownCost : owner < 0 ? config.neutralCost : config.enemyCost;
+		if (fromDistance + cost < distance[province])
+			push(province, fromDistance + cost);
+	};
+
+	for (int current = 0; pending > 0; ++current)
+	{
+		std::vector<int>& bucket = buckets[current % bucketCount];
+		while (!bucket.empty())
+		{
+			const int province = bucket.back();
+			bucket.pop_back();
+			--pending;
+
+			// Stale entry of a province that was reached on a shorter path later.
+			if (distance[province] != current)
+				continue;
+
+			relax(left[province], current);
+			relax(top[province], current);
+			relax(right[province], current);
+			relax(bottom[province], current);
+		}
+	}
+
+	// Downhill direction from the central difference; missing neighbours count as level.
+	for (int i = 0; i < provinceCount; ++i)
+	{
+		auto at = [&](int province)
+		{
+			return (float)(province < 0 ? distance[i] : distance[province]);
+		};
+
+		const float x = at(left[i]) - at(right[i]);
+		const float y = at(top[i]) - at(bottom[i]);
+		const float length = std::sqrt(x * x + y * y);
+
+		NavigationDirection& direction = output[i];
+		if (length == 0.0f)
+			direction = NavigationDirection();
+		else
+		{
+			direction.x = (signed char)std::lround(x / length * 127.0f);
+			direction.y = (signed char)std::lround(y / length * 127.0f);
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "game_state.h"
+#include "vector2.h"
+
+
+/// Direction towards a country's targets, in 1/127 units.
+struct NavigationDirection
+{
+	signed char x = 0;
+	signed char y = 0;
+
+	ShallowTest::Vector2 ToVector() const { return { x * (1.0f / 127.0f), y * (1.0f / 127.0f) }; }
+};
+
+struct NavigationConfig
+{
+	// Seconds of simulated time between refreshes.
+	float refreshIntervalInS = 0.25f;
+	// Step costs into an own, a neutral and an enemy province.
+	int ownCost = 1;
+	int neutralCost = 2;
+	int enemyCost = 3;
+};
+
+/// Per-country navigation over the province grid. For every country a distance
+/// field is built towards its targets (the foreign provinces bordering its
+/// territory, or its hub while it owns nothing), and each province stores the
+/// downhill direction of that field.
+///
+/// Fields are built on pool threads from a snapshot of the province owners, one
+/// batch of countries per background task, and only for countries whose
+/// territory or border changed since the last refresh. The simulation thread
+/// copies finished fields into the published buffer in Update, so armies only
+/// ever read a complete set.
+class NavigationFields
+{
+public:
+	/// The neighbour lists come from VectorFieldSystem::CreateDirections and are read
+	/// by the workers, so they must outlive the fields and stay unchanged.
+	NavigationFields(int countryCount, const std::vector<int>& left, const std::vector<int>& top,
+		const std::vector<int>& right, const std::vector<int>& bottom, const NavigationConfig& config = NavigationConfig());
+	NavigationFields(const NavigationFields&) = delete;
+	NavigationFields& operator=(const NavigationFields&) = delete;
+
+	/// Waits for fields in flight.
+	~NavigationFields();
+
+	/// Publishes finished fields and starts a refresh when one is due. Simulation thread only.
+	void Update(float deltaT, const std::vector<Province>& provinces, const std::vector<Country>& countries);
+
+	/// Waits for the refresh in flight and publishes it.
+	void Complete();
+
+	/// Country-major: entry country * provinceCount + province. Empty until the first refresh is published.
+	const std::vector<NavigationDirection>& GetDirections() const { return directions; }
+
+	/// Bytes held by the published fields and the change tracking; a refresh in flight adds as much again.
+	size_t GetMemoryBytes() const
+	{
+		return directions.capacity() * sizeof(NavigationDirection) + lastOwners.capacity() * sizeof(short) + lastHubs.capacity() * sizeof(int);
+	}
+
+private:
+	struct Refresh;
+
+	void start(const std::vector<Province>& provinces, const std::vector<Country>& countries);
+	void publish();
+	void buildField(const Refresh& refresh, int countryIndex, NavigationDirection* output) const;
+
+	const NavigationConfig config;
+	const int countryCount;
+	const int provinceCount;
+	const std::vector<int>& left;
+	const std::vector<int>& top;
+	const std::vector<int>& right;
+	const std::vector<int>& bottom;
+
+	float progress;
+	std::vector<short> lastOwners;
+	std::vector<int> lastHubs;
+	std::vector<NavigationDirection> directions;
+	std::shared_ptr<Refresh> inFlight;
+};
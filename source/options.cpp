@@ -0,0 +1,98 @@
+#include "options.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "game_state.h"
+
+
+AppOptions parseOptions(int argc, char** argv)
+{
+	AppOptions options;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+
+		if (std::strcmp(arg, "--threads") == 0 && hasValue)
+			options.threadPool.workerCount = std::max(1, std::atoi(argv[++i])) - 1;
+		else if (std::strcmp(arg, "--pin") == 0)
+			options.threadPool.pinThreads = true;
+		else if (std::strcmp(arg, "--first-core") == 0 && hasValue)
+			options.threadPool.firstCore = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--interleave") == 0)
+			options.interleaveMemory = true;
+		else if (std::strcmp(arg, "--hw-counters") == 0)
+			options.hardwareCounters = true;
+		else if (std::strcmp(arg, "--no-huge-pages") == 0)
+			options.largePages.hugePages = false;
+		else if (std::strcmp(arg, "--explicit-huge-pages") == 0)
+			options.largePages.explicitHugePages = true;
+		else if (std::strcmp(arg, "--prefault") == 0)
+			options.largePages.prefault = true;
+		else if (std::strcmp(arg, "--lean") == 0)
+			options.lean = true;
+		else if (std::strcmp(arg, "--tick-rate") == 0 && hasValue)
+			options.clock.tickRate = (float)std::atof(argv[++i]);
+		else if (std::strcmp(arg, "--fast-forward") == 0)
+			options.clock.fastForward = true;
+		else if (std::strcmp(arg, "--no-governor") == 0)
+			options.governor.enabled = false;
+		else if (std::strcmp(arg, "--frame-budget") == 0 && hasValue)
+			options.governor.frameBudgetInMs = std::max(1.0f, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--countries") == 0 && hasValue)
+			options.countryCount = std::clamp(std::atoi(argv[++i]), 1, Army::maxCountryCount);
+		else if (std::strcmp(arg, "--province-size") == 0 && hasValue)
+		{
+			// Below 8 px the province index no longer fits the compact army layout.
+			const int provinceSize = std::atoi(argv[++i]);
+			if (provinceSize >= 8 && Constants::screenWidth % provinceSize == 0 && Constants::screenHeight % provinceSize == 0)
+				options.provinceSize = provinceSize;
+			else
+				std::fprintf(stderr, "Province size %d does not tile the screen, keeping %d\n", provinceSize, options.provinceSize);
+		}
+		else if (std::strcmp(arg, "--no-separation") == 0)
+			options.armySeparation = false;
+		else if (std::strcmp(arg, "--no-navigation") == 0)
+			options.navigation = false;
+		else if (std::strcmp(arg, "--density") == 0)
+			options.densityMap = true;
+		else if (std::strcmp(arg, "--density-tile") == 0 && hasValue)
+			options.densityTileSize = std::max(1, std::atoi(argv[++i]));
+		else if (std::strcmp(arg, "--sprites") == 0)
+			options.sprites = true;
+		else if (std::strcmp(arg, "--sprite-budget") == 0 && hasValue)
+			options.spriteRenderer.pixelBudget = std::max(0, std::atoi(argv[++i]));
+		else if (std::strcmp(arg, "--events") == 0 && hasValue)
+			options.eventLogPath = argv[++i];
+		else if (std::strcmp(arg, "--metrics") == 0 && hasValue)
+			options.metricsJsonPath = argv[++i];
+		else if (std::strcmp(arg, "--metrics-csv") == 0 && hasValue)
+			options.metricsCsvPath = argv[++i];
+		else if (std::strcmp(arg, "--spectator-socket") == 0 && hasValue)
+			options.spectatorSocketPath = argv[++i];
+		else if (std::strcmp(arg, "--spectator-port") == 0 && hasValue)
+			options.spectatorPort = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--scaling-run") == 0 && hasValue)
+			options.scalingRunTicks = std::atoi(argv[++i]);
+		else if (std::strcmp(arg, "--stress") == 0 && hasValue)
+			options.stress.scenario = argv[++i];
+		else if (std::strcmp(arg, "--stress-frames") == 0 && hasValue)
+			options.stress.frames = std::max(1, std::atoi(argv[++i]));
+		else if (std::strcmp(arg, "--stress-baseline") == 0 && hasValue)
+			options.stress.baselinePath = argv[++i];
+		else if (std::strcmp(arg, "--stress-update") == 0)
+			options.stress.updateBaselines = true;
+		else if (std::strcmp(arg, "--stress-threshold") == 0 && hasValue)
+			options.stress.timeThreshold = std::max(1.0f, (float)std::atof(argv[++i]));
+		else if (std::strcmp(arg, "--stress-memory-threshold") == 0 && hasValue)
+			options.stress.memoryThreshold = std::max(1.0f, (float)std::atof(argv[++i]));
+		else
+			std::fprintf(stderr, "Unknown option: %s\n", arg);
+	}
+
+	return options;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+
+#include "constants.h"
+#include "frame_governor.h"
+#include "large_pages.h"
+#include "sprite_renderer.h"
+#include "stress_suite.h"
+#include "simulation_clock.h"
+#include "thread_pool.h"
+
+
+/// Command line switches.
+struct AppOptions
+{
+	ThreadPoolConfig threadPool;
+	SimulationClockConfig clock;
+	// The game trades fidelity for a steady tick rate unless --no-governor is given.
+	FrameGovernorConfig governor = { true };
+
+	// Huge page backing and prefaulting of the army-sized buffers.
+	LargePageConfig largePages;
+	// Spread the world buffers over all NUMA nodes.
+	bool interleaveMemory = false;
+	// CPU performance counters per system, Linux only; C prints the last frame.
+	bool hardwareCounters = false;
+	// Drop optional buffers to fit more instances per host.
+	bool lean = false;
+
+	// Number of countries, up to Army::maxCountryCount.
+	int countryCount = Constants::maxCountries;
+
+	// Edge length of a province in pixels; must tile the screen.
+	int provinceSize = Constants::provinceSize;
+
+	// Armies push each other apart.
+	bool armySeparation = true;
+	// Armies head for their country's borders along per-country navigation fields.
+	bool navigation = true;
+
+	// Start in the density heatmap render mode, binning armies into tiles of this many pixels.
+	bool densityMap = false;
+	int densityTileSize = 2;
+
+	// Start in the sprite render mode, blending at most this many sprite pixels per frame.
+	bool sprites = false;
+	SpriteRendererConfig spriteRenderer;
+
+	// Binary simulation event log; empty disables the event stream.
+	std::string eventLogPath;
+
+	// Periodic metrics export files; both empty by default, so nothing is written.
+	std::string metricsJsonPath;
+	std::string metricsCsvPath;
+
+	// Spectator stream endpoints; both off by default.
+	std::string spectatorSocketPath;
+	int spectatorPort = 0;
+
+	// Ticks timed per thread count by the scaling run; 0 runs the game instead.
+	int scalingRunTicks = 0;
+
+	// Headless stress scenarios compared against baselines; off unless a scenario is named.
+	StressSuiteConfig stress;
+};
+
+AppOptions parseOptions(int argc, char** argv);
@@ -1,20 +1,38 @@
 #include "parallel_for.h"
 
 
+namespace
+{
+	// More tasks than threads, so a slow task does not hold up the whole job.
+	const int tasksPerThread = 4;
+}
+
 void serialFor(const std::vector<int>& collection, std::function<void(int)> callback)
 {
-	std::for_each(std::execution::seq, collection.begin(), collection.end(), callback);
+	std::for_each(collection.begin(), collection.end(), callback);
 };
 
 void parallelFor(const std::vector<int>& collection, std::function<void(int)> callback)
 {
-	std::for_each(std::execution::par_unseq, collection.begin(), collection.end(), callback);
+	ThreadPool& pool = ThreadPool::Get();
+	const int size = (int)collection.size();
+	const int taskCount = std::min(size, pool.GetThreadCount() * tasksPerThread);
+
+	pool.Run(taskCount, [&](int task)
+		{
+			const int begin = (int)((long long)size * task / taskCount);
+			const int end = (int)((long long)size * (task + 1) / taskCount);
+			for (int i = begin; i < end; ++i)
+			{
+				callback(collection[i]);
+			}
+		});
 };
 
 int splitParallelForGetBatchCount(const std::vector<int>& collection, int chunkSize)
 {
 	int chunkCount = std::max(1, (int)(collection.size() / chunkSize));
-	chunkCount += (chunkSize * chunkCount < collection.size()) ? 1 : 0;
+	chunkCount += (chunkSize * chunkCount < (int)collection.size()) ? 1 : 0;
 	return chunkCount;
 }
 
@@ -25,10 +43,7 @@ void splitParallelFor(const std::vector<int>& collection, int chunkSize, std::fu
 
 	int chunkCount = splitParallelForGetBatchCount(collection, chunkSize);
 
-	std::vector<int> chunks; chunks.resize(chunkCount);
-	std::iota(chunks.begin(), chunks.end(), 0);
-
-	std::for_each(std::execution::par_unseq, chunks.begin(), chunks.end(), [&](int i)
+	ThreadPool::Get().Run(chunkCount, [&](int i)
 		{
 			callback(
 				makeConstRange<int>(
@@ -1,61 +1,37 @@
 #pragma once
 #include <algorithm>
 #include <assert.h>
-#include <execution>
 #include <functional>
 #include <vector>
 
+#include "thread_pool.h"
 
-template<typename T>
-std::vector<T> slice(std::vector<T>& v, int m, int n)
+
+template<typename T, class InputAllocator, class OutputAllocator>
+void slice(const std::vector<T, InputAllocator>& v, int m, int n, std::vector<T, OutputAllocator>& vec)
 {
-	const size_t size = n - m + 1;
-	std::vector<T> vec(size);
+	const int size = n - m + 1;
 
-	const int num_threads = std::min((int)size, (int)std::thread::hardware_concurrency());
-	assert(num_threads > 0);
-	const int chunkSize = std::max(1, (int)(size / num_threads));
+	assert((int)vec.size() >= size);
 
-	std::vector<std::pair<int, int>> chunks;
-	for (int i = 0; i < num_threads; ++i)
-	{
-		chunks.emplace_back(i * chunkSize, i * chunkSize + std::min(chunkSize, (int)size));
-	}
+	ThreadPool& pool = ThreadPool::Get();
+	const int chunkCount = std::min(size, pool.GetThreadCount());
+	assert(chunkCount > 0);
 
-	std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](const std::pair<int, int>& pair)
+	pool.Run(chunkCount, [&](int i)
 		{
-			std::copy(v.begin() + m + pair.first, v.begin() + m + pair.second, vec.begin() + pair.first);
+			const int begin = (int)((long long)size * i / chunkCount);
+			const int end = (int)((long long)size * (i + 1) / chunkCount);
+			std::copy(v.begin() + m + begin, v.begin() + m + end, vec.begin() + begin);
 		});
-
-	return vec;
 }
 
 template<typename T>
-void slice(const std::vector<T>& v, int m, int n, std::vector<T>& vec)
+std::vector<T> slice(std::vector<T>& v, int m, int n)
 {
-	const size_t size = n - m + 1;
-
-	assert(vec.size() >= size);
-
-	const int num_threads = std::min((int)size, (int)std::thread::hardware_concurrency());
-	assert(num_threads > 0);
-	const int chunkSize = std::max(1, (int)std::round((float)size / (float)num_threads));
-	int chunkCount = std::max(1, (int)(size / chunkSize));
-	chunkCount += (chunkSize * chunkCount < size) ? 1 : 0;
-
-	std::vector<std::pair<int, int>> chunks;
-	for (int i = 0; i < chunkCount; ++i)
-	{
-		if (i * chunkSize > size)
-			break;
-
-		chunks.emplace_back(i * chunkSize, std::min(i * chunkSize + chunkSize, (int)size));
-	}
-
-	std::for_each(std::execution::par, chunks.begin(), chunks.end(), [&](const std::pair<int, int>& pair)
-		{
-			std::copy(v.begin() + m + pair.first, v.begin() + m + pair.second, vec.begin() + pair.first);
-		});
+	std::vector<T> vec(n - m + 1);
+	slice(v, m, n, vec);
+	return vec;
 }
 
 template<class It>
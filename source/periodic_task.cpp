@@ -0,0 +1,172 @@
+#include "periodic_task.h"
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "metrics.h"
+#include "optick.h"
+#include "thread_pool.h"
+
+
+namespace
+{
+	// Metrics keeps names by pointer, so derived names live until exit.
+	const char* internName(const char* name, const char* suffix)
+	{
+		static std::mutex mutex;
+		static std::deque<std::string> names;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		names.push_back(std::string(name) + suffix);
+		return names.back().c_str();
+	}
+
+	long long nanosecondsSince(std::chrono::steady_clock::time_point begin)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	}
+}
+
+PeriodicTask::PeriodicTask(Mode mode, float interval, float budgetInMs, const char* name)
+	: _mode(mode)
+	, _interval(interval)
+	, _budgetInMs(budgetInMs)
+	, _progress(0.0f)
+	, _name(name)
+	, _workName(internName(name, ".Work"))
+	, _intervalName(internName(name, ".Interval"))
+	, _overrunName(internName(name, ".Overruns"))
+{}
+
+PeriodicTask::PeriodicTask(std::function<void()> fn, float interval, const char* name)
+	: PeriodicTask(Mode::Sync, interval, 0.0f, name)
+{
+	_fn = std::move(fn);
+}
+
+PeriodicTask::PeriodicTask(std::function<void()> work, std::function<void()> apply, float interval, const char* name)
+	: PeriodicTask(Mode::Async, interval, 0.0f, name)
+{
+	_fn = std::move(work);
+	_apply = std::move(apply);
+}
+
+PeriodicTask::PeriodicTask(std::function<bool()> step, float interval, float budgetInMs, const char* name)
+	: PeriodicTask(Mode::Incremental, interval, budgetInMs, name)
+{
+	_step = std::move(step);
+}
+
+PeriodicTask::~PeriodicTask()
+{
+	if (_state)
+	{
+		while (!_state->done.load(std::memory_order_acquire))
+			std::this_thread::yield();
+	}
+}
+
+void PeriodicTask::update(float deltaT)
+{
+	OPTICK_EVENT(__FUNCTION__);
+	MetricsScope scope(_name);
+
+	// Applying finished work first frees the task to start the next run.
+	if (_mode == Mode::Async)
+		poll(false);
+
+	_progress += deltaT;
+	if (_progress > _interval)
+	{
+		_progress -= _interval;
+		if (_running)
+			Metrics::Count(_overrunName);
+		else
+			start();
+	}
+
+	// Steps an incremental run, or applies work the pool ran inline.
+	poll(false);
+}
+
+void PeriodicTask::complete()
+{
+	OPTICK_EVENT(__FUNCTION__);
+	MetricsScope scope(_name);
+
+	poll(true);
+}
+
+void PeriodicTask::start()
+{
+	const auto now = std::chrono::steady_clock::now();
+	if (_hasStarted)
+		Metrics::Record(_intervalName, std::chrono::duration_cast<std::chrono::nanoseconds>(now - _lastStart).count());
+	_lastStart = now;
+	_hasStarted = true;
+
+	switch (_mode)
+	{
+	case Mode::Sync:
+		_fn();
+		break;
+
+	case Mode::Async:
+	{
+		_running = true;
+		_state = std::make_shared<AsyncState>();
+		ThreadPool::Get().Submit([work = _fn, state = _state]()
+			{
+				const auto begin = std::chrono::steady_clock::now();
+				work();
+				state->durationInNs = nanosecondsSince(begin);
+				state->done.store(true, std::memory_order_release);
+			});
+		break;
+	}
+
+	case Mode::Incremental:
+		_running = true;
+		break;
+	}
+}
+
+void PeriodicTask::poll(bool wait)
+{
+	if (!_running)
+		return;
+
+	if (_mode == Mode::Async)
+	{
+		if (wait)
+		{
+			OPTICK_EVENT("Wait for work");
+			while (!_state->done.load(std::memory_order_acquire))
+				std::this_thread::yield();
+		}
+		else if (!_state->done.load(std::memory_order_acquire))
+			return;
+
+		Metrics::Record(_workName, _state->durationInNs);
+		_state.reset();
+		_running = false;
+		if (_apply)
+			_apply();
+	}
+	else if (_mode == Mode::Incremental)
+	{
+		// At least one step per update, so a tiny budget still makes progress.
+		const auto begin = std::chrono::steady_clock::now();
+		const long long budgetInNs = (long long)(_budgetInMs * 1e6f);
+		do
+		{
+			if (_step())
+			{
+				_running = false;
+				return;
+			}
+		} while (wait || nanosecondsSince(begin) < budgetInNs);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+
+/// Runs work every interval seconds of simulated time, in one of three modes:
+///  - synchronous: fn runs inside update(), as before;
+///  - asynchronous: work runs on an idle pool thread, and apply runs on the
+///    updating thread at the first update() after work finished, so the
+///    owner's data is only touched from its own thread;
+///  - incremental: step runs inside update() until it returns true, but only
+///    for budgetInMs per update, so long jobs are spread over several ticks.
+///
+/// Timings go to Metrics as "<name>" (time spent in update), "<name>.Work"
+/// (asynchronous work duration) and "<name>.Interval" (time between starts).
+/// A run that comes due while the previous one is still in flight is skipped
+/// and counted in "<name>.Overruns". Update and complete from one thread only.
+class PeriodicTask
+{
+public:
+	PeriodicTask(std::function<void()> fn, float interval, const char* name = "PeriodicTask");
+	PeriodicTask(std::function<void()> work, std::function<void()> apply, float interval, const char* name);
+	PeriodicTask(std::function<bool()> step, float interval, float budgetInMs, const char* name);
+
+	PeriodicTask(const PeriodicTask&) = delete;
+	PeriodicTask& operator=(const PeriodicTask&) = delete;
+
+	/// Waits for in-flight work without applying it.
+	~PeriodicTask();
+
+	void update(float deltaT);
+
+	/// Finishes the run in flight, if any: waits for asynchronous work and applies
+	/// it, or runs the remaining incremental steps without a budget.
+	void complete();
+
+	bool isRunning() const { return _running; }
+
+private:
+	enum class Mode
+	{
+		Sync,
+		Async,
+		Incremental,
+	};
+
+	// Shared with the pool thread, so the task may be destroyed while work is queued.
+	struct AsyncState
+	{
+		std::atomic<bool> done = false;
+		long long durationInNs = 0;
+	};
+
+	PeriodicTask(Mode mode, float interval, float budgetInMs, const char* name);
+
+	void start();
+	void poll(bool wait);
+
+	const Mode _mode;
+	std::function<void()> _fn;
+	std::function<void()> _apply;
+	std::function<bool()> _step;
+	const float _interval;
+	const float _budgetInMs;
+	float _progress;
+
+	const char* _name;
+	const char* _workName;
+	const char* _intervalName;
+	const char* _overrunName;
+
+	bool _running = false;
+	std::shared_ptr<AsyncState> _state;
+	std::chrono::steady_clock::time_point _lastStart;
+	bool _hasStarted = false;
+};
@@ -0,0 +1,348 @@
+#include "province_buckets.h"
+
+#include <algorithm>
+#include <memory_resource>
+#include <numeric>
+
+#include "frame_arena.h"
+#include "grid.h"
+#include "metrics.h"
+#include "optick.h"
+#include "parallel_for.h"
+#include "systems.h"
+#include "thread_pool.h"
+
+
+ProvinceBuckets::ProvinceBuckets(int provinceCount, int countryCount)
+	: provinceCount(provinceCount)
+	, countryCount(countryCount)
+{
+	starts.resize(provinceCount);
+	counts.resize(provinceCount);
+	capacities.resize(provinceCount);
+	changed.resize(provinceCount);
+	slots.resize(Constants::maxArmies, -1);
+	// Room for every army plus the slack and growth allowed before a rebuild.
+	assignments.reserve(maxBucketSize(Constants::maxArmies));
+
+	if ((long long)provinceCount * countryCount <= maxCountryCountsSize)
+		countryCounts.resize((size_t)provinceCount * countryCount);
+}
+
+void ProvinceBuckets::BeginCrossings(int batchCount)
+{
+	if ((int)crossings.size() < batchCount)
+		crossings.resize(batchCount);
+	for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+		crossings[batchIndex].clear();
+	crossingBatchCount = batchCount;
+}
+
+void ProvinceBuckets::ApplyCrossings(const std::vector<tProvinceIndex>& provinceIndices, ArmyVector& armies, int armyCount)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	int crossingCount = 0;
+	for (int batchIndex = 0; batchIndex < crossingBatchCount; ++batchIndex)
+		crossingCount += (int)crossings[batchIndex].size();
+	Metrics::Set("ProvinceBuckets.Crossings", crossingCount);
+
+	// Batches hold distinct armies.
+	ThreadPool::Get().Run(crossingBatchCount, [&](int batchIndex)
+		{
+			for (const Crossing& crossing : crossings[batchIndex])
+				armies[crossing.armyIndex].setProvinceIndex(crossing.toProvinceIndex);
+		});
+
+	// Each crossing is a few scattered writes, while a rebuild streams over the
+	// armies, so past a share of the armies the next Update rebuilds instead.
+	if ((long long)crossingCount * maxCrossingShare > armyCount)
+		current = false;
+	else if (current && crossingCount > 0)
+		moveCrossings(provinceIndices, crossingCount);
+
+	for (int batchIndex = 0; batchIndex < crossingBatchCount; ++batchIndex)
+		crossings[batchIndex].clear();
+	crossingBatchCount = 0;
+}
+
+void ProvinceBuckets::Insert(tArmyIndex armyIndex, ArmyVector& armies)
+{
+	const tProvinceIndex provinceIndex = GridGeometry::Get().GetProvinceIndexForPosition(armies[armyIndex].getPosition());
+	armies[armyIndex].setProvinceIndex(provinceIndex);
+	if (!current)
+		return;
+
+	if (counts[provinceIndex] == capacities[provinceIndex])
+		grow(provinceIndex, counts[provinceIndex] + 1);
+	put(provinceIndex, armyIndex, armies[armyIndex].getCountryIndex());
+}
+
+void ProvinceBuckets::Remove(tArmyIndex armyIndex, const ArmyVector& armies)
+{
+	if (!current || slots[armyIndex] < 0)
+		return;
+
+	take(armies[armyIndex].getProvinceIndex(), armyIndex, armies[armyIndex].getCountryIndex());
+	slots[armyIndex] = -1;
+}
+
+void ProvinceBuckets::Relocate(tArmyIndex from, tArmyIndex to)
+{
+	if (!current)
+		return;
+
+	slots[to] = slots[from];
+	slots[from] = -1;
+	if (slots[to] >= 0)
+		assignments[slots[to]] = to;
+}
+
+void ProvinceBuckets::Update(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces,
+	const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	if (!current || ++ticksSinceRebuild >= rebuildIntervalInTicks || assignments.size() > maxBucketSize(armyIndices.size()))
+	{
+		rebuild(provinceIndices, provinces, armyIndices, armies);
+		return;
+	}
+
+	for (int i : provinceIndices)
+	{
+		provinces[i].armyStartIndex = starts[i];
+		provinces[i].armyCount._a = counts[i];
+	}
+}
+
+size_t ProvinceBuckets::GetMemoryBytes() const
+{
+	size_t bytes = (starts.capacity() + counts.capacity() + capacities.capacity() + assignments.capacity() + slots.capacity() + countryCounts.capacity()) * sizeof(int)
+		+ changed.capacity();
+	for (const std::vector<Crossing>& batch : crossings)
+		bytes += batch.capacity() * sizeof(Crossing);
+	return bytes;
+}
+
+void ProvinceBuckets::moveCrossings(const std::vector<tProvinceIndex>& provinceIndices, int crossingCount)
+{
+	// Crossings are grouped by the province they leave and the one they enter,
+	// so that afterwards every province is updated by one thread and within its
+	// own bucket: first all armies leave, then all arrive.
+	std::pmr::vector<int> leaveStart(provinceCount + 1, 0, FrameArena::Resource());
+	std::pmr::vector<int> enterStart(provinceCount + 1, 0, FrameArena::Resource());
+	for (int batchIndex = 0; batchIndex < crossingBatchCount; ++batchIndex)
+	{
+		for (const Crossing& crossing : crossings[batchIndex])
+		{
+			++leaveStart[crossing.fromProvinceIndex + 1];
+			++enterStart[crossing.toProvinceIndex + 1];
+		}
+	}
+
+	for (int i : provinceIndices)
+	{
+		const int neededCapacity = counts[i] - leaveStart[i + 1] + enterStart[i + 1];
+		if (neededCapacity > capacities[i])
+			grow(i, neededCapacity);
+	}
+
+	std::partial_sum(leaveStart.begin(), leaveStart.end(), leaveStart.begin());
+	std::partial_sum(enterStart.begin(), enterStart.end(), enterStart.begin());
+
+	std::pmr::vector<const Crossing*> leaving(crossingCount, FrameArena::Resource());
+	std::pmr::vector<const Crossing*> entering(crossingCount, FrameArena::Resource());
+	{
+		std::pmr::vector<int> leaveOffsets(leaveStart, FrameArena::Resource());
+		std::pmr::vector<int> enterOffsets(enterStart, FrameArena::Resource());
+		for (int batchIndex = 0; batchIndex < crossingBatchCount; ++batchIndex)
+		{
+			for (const Crossing& crossing : crossings[batchIndex])
+			{
+				leaving[leaveOffsets[crossing.fromProvinceIndex]++] = &crossing;
+				entering[enterOffsets[crossing.toProvinceIndex]++] = &crossing;
+			}
+		}
+	}
+
+	// Leaving only rewrites the slots of armies staying in the province, and
+	// entering those of the arriving armies, so provinces never share data.
+	parallelFor(provinceIndices, [&](int i)
+		{
+			for (int k = leaveStart[i]; k < leaveStart[i + 1]; ++k)
+				take(i, leaving[k]->armyIndex, leaving[k]->countryIndex);
+		});
+
+	parallelFor(provinceIndices, [&](int i)
+		{
+			for (int k = enterStart[i]; k < enterStart[i + 1]; ++k)
+				put(i, entering[k]->armyIndex, entering[k]->countryIndex);
+		});
+}
+
+void ProvinceBuckets::take(tProvinceIndex provinceIndex, tArmyIndex armyIndex, tCountryIndex countryIndex)
+{
+	// The last army of the bucket fills the hole.
+	const int slot = slots[armyIndex];
+	assert(assignments[slot] == armyIndex);
+	const tArmyIndex lastArmyIndex = assignments[starts[provinceIndex] + --counts[provinceIndex]];
+	assignments[slot] = lastArmyIndex;
+	slots[lastArmyIndex] = slot;
+
+	if (HasCountryCounts())
+	{
+		--countryCounts[(size_t)provinceIndex * countryCount + countryIndex];
+		changed[provinceIndex] = 1;
+	}
+}
+
+void ProvinceBuckets::put(tProvinceIndex provinceIndex, tArmyIndex armyIndex, tCountryIndex countryIndex)
+{
+	assert(counts[provinceIndex] < capacities[provinceIndex]);
+	const int slot = starts[provinceIndex] + counts[provinceIndex]++;
+	assignments[slot] = armyIndex;
+	slots[armyIndex] = slot;
+
+	if (HasCountryCounts())
+	{
+		++countryCounts[(size_t)provinceIndex * countryCount + countryIndex];
+		changed[provinceIndex] = 1;
+	}
+}
+
+void ProvinceBuckets::grow(tProvinceIndex provinceIndex, int minCapacity)
+{
+	// The bucket moves to the end of the array with at least twice the room;
+	// the old slice stays unused until the next rebuild.
+	const int start = (int)assignments.size();
+	const int capacity = std::max({ 2 * capacities[provinceIndex], minCapacity, slackFor(0) });
+	assignments.resize(start + capacity);
+	for (int k = 0; k < counts[provinceIndex]; ++k)
+	{
+		const tArmyIndex armyIndex = assignments[starts[provinceIndex] + k];
+		assignments[start + k] = armyIndex;
+		slots[armyIndex] = start + k;
+	}
+	starts[provinceIndex] = start;
+	capacities[provinceIndex] = capacity;
+	Metrics::Count("ProvinceBuckets.Grown");
+}
+
+void ProvinceBuckets::rebuild(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces,
+	const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies)
+{
+	OPTICK_EVENT(__FUNCTION__);
+	Metrics::Count("ProvinceBuckets.Rebuilds");
+
+	const int batchSize = 65535;
+	const int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
+
+	// Army count per batch per province, later turned into write offsets.
+	// Batch-major, so every batch touches only its own row.
+	std::pmr::vector<int> batchOffsets((size_t)provinceCount * batchCount, 0, FrameArena::Resource());
+
+	{
+		OPTICK_EVENT("Count");
+
+		dispatchGrid(GridGeometry::Get(), [&](const auto& grid)
+			{
+				splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+					{
+						int* batchCounts = batchOffsets.data() + (size_t)batchIndex * provinceCount;
+						for (int i : range)
+						{
+							const tProvinceIndex provinceIndex = grid.GetProvinceIndexForPosition(armies[i].getPosition());
+							armies[i].setProvinceIndex(provinceIndex);
+							++batchCounts[provinceIndex];
+						}
+					});
+			});
+	}
+
+	int totalCount = 0;
+	{
+		OPTICK_EVENT("Total");
+		for (int i : provinceIndices)
+		{
+			starts[i] = totalCount;
+			for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+			{
+				int& batchOffset = batchOffsets[(size_t)batchIndex * provinceCount + i];
+				const int count = batchOffset;
+				batchOffset = totalCount;
+				totalCount += count;
+			}
+			counts[i] = totalCount - starts[i];
+			capacities[i] = counts[i] + slackFor(counts[i]);
+			totalCount = starts[i] + capacities[i];
+
+			provinces[i].armyStartIndex = starts[i];
+			provinces[i].armyCount._a = counts[i];
+		}
+	}
+
+	assignments.resize(totalCount);
+	// Armies past the live range are not bucketed; the live ones get their slot below.
+	std::fill(slots.begin() + armyIndices.size(), slots.end(), -1);
+
+	{
+		OPTICK_EVENT("Set");
+		splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+			{
+				int* offsets = batchOffsets.data() + (size_t)batchIndex * provinceCount;
+				for (int i : range)
+				{
+					const int slot = offsets[armies[i].getProvinceIndex()]++;
+					assignments[slot] = i;
+					slots[i] = slot;
+				}
+			});
+	}
+
+	if (HasCountryCounts())
+		countCountries(provinceIndices, provinces, armies);
+
+	current = true;
+	ticksSinceRebuild = 0;
+}
+
+void ProvinceBuckets::countCountries(const std::vector<tProvinceIndex>& provinceIndices, const std::vector<Province>& provinces, const ArmyVector& armies)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	auto countRange = [&](int* output, int armyBegin, int armyEnd)
+	{
+		std::fill(output, output + countryCount, 0);
+		for (int slot = armyBegin; slot < armyEnd; ++slot)
+			++output[armies[assignments[slot]].getCountryIndex()];
+	};
+
+	// Parts of split provinces count into their own row, summed up afterwards.
+	const ProvinceTasks tasks(provinceIndices, provinces);
+	std::pmr::vector<int> partCounts((size_t)tasks.GetTaskCount() * countryCount, FrameArena::Resource());
+
+	tasks.Run(
+		[&](int i)
+		{
+			countRange(countryCounts.data() + (size_t)i * countryCount, starts[i], starts[i] + counts[i]);
+		},
+		[&](int, int armyBegin, int armyEnd, int taskIndex)
+		{
+			countRange(partCounts.data() + (size_t)taskIndex * countryCount, armyBegin, armyEnd);
+		});
+
+	tasks.ForEachSplit([&](int i, int firstTaskIndex, int partCount)
+		{
+			int* row = countryCounts.data() + (size_t)i * countryCount;
+			std::fill(row, row + countryCount, 0);
+			for (int taskIndex = firstTaskIndex; taskIndex < firstTaskIndex + partCount; ++taskIndex)
+			{
+				const int* part = partCounts.data() + (size_t)taskIndex * countryCount;
+				for (int countryIndex = 0; countryIndex < countryCount; ++countryIndex)
+					row[countryIndex] += part[countryIndex];
+			}
+		});
+
+	std::fill(changed.begin(), changed.end(), 1);
+}
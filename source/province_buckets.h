@@ -0,0 +1,122 @@
+#pragma once
+#include <vector>
+
+#include "game_state.h"
+
+
+/// Armies bucketed by province, kept up to date incrementally instead of being
+/// sorted again every tick. Every province owns a slice of the bucket array
+/// with some slack; movement records the armies that left their province, and
+/// only those move between buckets. Kills and spawns are applied one army at a
+/// time as ArmySystem::MergeKilledAndSpawned reuses and compacts army slots.
+///
+/// Per-province country counts follow the same deltas, so the ownership vote
+/// only looks again at provinces whose armies changed. They are dropped when
+/// provinces times countries gets too large, and the vote recounts instead.
+///
+/// A bucket running out of slack moves to the end of the array with twice the
+/// room. The buckets are rebuilt every rebuildIntervalInTicks, or earlier once
+/// the abandoned slices take too much space, which compacts the array and puts
+/// each bucket back into army order. They are also rebuilt when more than one
+/// army in maxCrossingShare crossed a border, as moving that many one by one
+/// costs more than sorting them all again.
+///
+/// Invariant: a bucketed army's province index is the province of its bucket,
+/// once the crossings of the last movement are applied.
+class ProvinceBuckets
+{
+public:
+	static const int rebuildIntervalInTicks = 256;
+	static const int maxCrossingShare = 4;
+	// Country counts are kept up to this many entries, 16 MB.
+	static const int maxCountryCountsSize = 1 << 22;
+
+	ProvinceBuckets(int provinceCount, int countryCount);
+
+	/// An army that left fromProvinceIndex; its province index says so until ApplyCrossings.
+	struct Crossing
+	{
+		tArmyIndex armyIndex;
+		tProvinceIndex fromProvinceIndex;
+		tProvinceIndex toProvinceIndex;
+		tCountryIndex countryIndex;
+	};
+
+	/// Starts collecting border crossings for a movement pass split into batchCount batches.
+	void BeginCrossings(int batchCount);
+
+	/// Records an army whose movement took it into another province. Safe from
+	/// several threads as long as each uses its own batch.
+	void AddCrossing(int batchIndex, const Crossing& crossing) { crossings[batchIndex].push_back(crossing); }
+
+	/// Sets the province index of the armies recorded since BeginCrossings and
+	/// moves them into their new buckets, in parallel over provinces, or leaves
+	/// that to the next rebuild when there are too many. Must run before any army
+	/// index is reused or swapped.
+	void ApplyCrossings(const std::vector<tProvinceIndex>& provinceIndices, ArmyVector& armies, int armyCount);
+
+	/// Buckets an army at its current position and sets its province index.
+	void Insert(tArmyIndex armyIndex, ArmyVector& armies);
+	/// Takes an army out of its bucket; its country and province must be the ones it was bucketed with.
+	void Remove(tArmyIndex armyIndex, const ArmyVector& armies);
+	/// Follows an army moved from one index to another.
+	void Relocate(tArmyIndex from, tArmyIndex to);
+
+	/// Rebuilds the buckets from the army positions when due, and publishes the bucket ranges as the provinces' armyStartIndex and armyCount.
+	void Update(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces,
+		const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies);
+
+	/// Province-major bucket array; only the first armyCount entries of a bucket are armies.
+	const std::vector<tArmyIndex>& GetArmies() const { return assignments; }
+
+	bool HasCountryCounts() const { return !countryCounts.empty(); }
+	/// Armies per country in a province.
+	const int* GetCountryCounts(tProvinceIndex provinceIndex) const { return countryCounts.data() + (size_t)provinceIndex * countryCount; }
+	int GetCountryCount() const { return countryCount; }
+
+	/// True once after the country counts of a province changed. Distinct provinces may be taken from different threads.
+	bool TakeChanged(tProvinceIndex provinceIndex)
+	{
+		const bool result = changed[provinceIndex] != 0;
+		changed[provinceIndex] = 0;
+		return result;
+	}
+
+	size_t GetMemoryBytes() const;
+
+private:
+	static int slackFor(int armyCount) { return armyCount / 8 + 16; }
+	// Array size past which a rebuild is due.
+	size_t maxBucketSize(size_t armyCount) const { return 2 * armyCount + (size_t)provinceCount * slackFor(0) * 4; }
+
+	void moveCrossings(const std::vector<tProvinceIndex>& provinceIndices, int crossingCount);
+	// Bucket operations without the checks; put needs room in the bucket.
+	void take(tProvinceIndex provinceIndex, tArmyIndex armyIndex, tCountryIndex countryIndex);
+	void put(tProvinceIndex provinceIndex, tArmyIndex armyIndex, tCountryIndex countryIndex);
+	void grow(tProvinceIndex provinceIndex, int minCapacity);
+	void rebuild(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces,
+		const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies);
+	void countCountries(const std::vector<tProvinceIndex>& provinceIndices, const std::vector<Province>& provinces, const ArmyVector& armies);
+
+	const int provinceCount;
+	const int countryCount;
+
+	std::vector<int> starts;
+	std::vector<int> counts;
+	std::vector<int> capacities;
+	std::vector<tArmyIndex> assignments;
+	// Bucket slot of every army, -1 for armies not bucketed.
+	std::vector<int> slots;
+
+	// Province-major, countryCount entries per province.
+	std::vector<int> countryCounts;
+	std::vector<char> changed;
+
+	std::vector<std::vector<Crossing>> crossings;
+	int crossingBatchCount = 0;
+
+	// False before the first rebuild and while one is pending for too many
+	// crossings; bucket updates are skipped then.
+	bool current = false;
+	int ticksSinceRebuild = 0;
+};
@@ -0,0 +1,67 @@
+#include "scaling_report.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "simulation.h"
+#include "thread_pool.h"
+
+
+namespace
+{
+	const int warmUpTicks = 10;
+	const unsigned int seed = 1234;
+
+	std::vector<int> threadCounts(int maxThreads)
+	{
+		std::vector<int> counts;
+		for (int count = 1; count < maxThreads; count *= 2)
+			counts.push_back(count);
+		counts.push_back(maxThreads);
+		return counts;
+	}
+}
+
+void runScalingReport(const AppOptions& options)
+{
+	const int maxThreads = options.threadPool.workerCount >= 0 ? options.threadPool.workerCount + 1 : std::max(1, (int)std::thread::hardware_concurrency());
+	const float tickDeltaInS = 1.0f / options.clock.tickRate;
+
+	std::printf("threads, frame ms, speedup, efficiency\n");
+
+	double singleThreadedFrameInMs = 0.0;
+	for (int threads : threadCounts(maxThreads))
+	{
+		ThreadPoolConfig poolConfig = options.threadPool;
+		poolConfig.workerCount = threads - 1;
+		ThreadPool::Configure(poolConfig);
+
+		std::srand(seed);
+		if (options.interleaveMemory)
+			ThreadPool::SetInterleavedMemory(true);
+		Simulation simulation(tickDeltaInS, options.countryCount);
+		if (options.interleaveMemory)
+			ThreadPool::SetInterleavedMemory(false);
+		const TickInput input;
+
+		for (int i = 0; i < warmUpTicks; ++i)
+			simulation.Tick(input);
+
+		const auto begin = std::chrono::steady_clock::now();
+		for (int i = 0; i < options.scalingRunTicks; ++i)
+			simulation.Tick(input);
+		const auto end = std::chrono::steady_clock::now();
+
+		const double frameInMs = std::chrono::duration<double, std::milli>(end - begin).count() / options.scalingRunTicks;
+		if (threads == 1)
+			singleThreadedFrameInMs = frameInMs;
+
+		const double speedup = singleThreadedFrameInMs / frameInMs;
+		std::printf("%d, %.3f, %.2f, %.2f\n", threads, frameInMs, speedup, speedup / threads);
+		std::fflush(stdout);
+	}
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include "options.h"
+
+
+/// Runs the simulation headless for 1..N threads and prints frame time,
+/// speedup and parallel efficiency relative to the single-threaded run.
+void runScalingReport(const AppOptions& options);
@@ -0,0 +1,192 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <random>
+
+#include "frame_arena.h"
+#include "hardware_counters.h"
+#include "memory_report.h"
+#include "metrics.h"
+#include "optick.h"
+#include "parallel_for.h"
+
+
+Simulation::Simulation(float tickDeltaInS, int countryCount, bool lean)
+    : tickDeltaInS(tickDeltaInS)
+    , provinceBuckets(GridGeometry::Get().GetProvinceCount(), countryCount)
+    , navigation(countryCount, left, top, right, bottom)
+    , spawnTask([this]{ SpawnSystem::Spawn(validArmyIndices, armies, countryIndices, countries, this->tickDeltaInS, spawnedArmiesCountByCountry); }, 0.01f, "SpawnTask")
+{
+    const int screenWidth = Constants::screenWidth;
+    const int screenHeight = Constants::screenHeight;
+
+    assert(countryCount > 0 && countryCount <= Army::maxCountryCount);
+    countries.resize(countryCount);
+    armies.resize(Constants::maxArmies);
+    const int provinceCount = GridGeometry::Get().GetProvinceCount();
+    provinces.resize(provinceCount);
+
+    std::default_random_engine generator;
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    std::vector<ShallowTest::Vector2> CountryPositions(countryCount);
+    for (int i = 0; i < countryCount; i++)
+    {
+        CountryPositions[i] = { screenWidth / 2, screenHeight / 2 };
+        ShallowTest::Vector2 offset;
+        offset.x = distribution(generator) * (screenWidth / 2 - 150.0f);
+        offset.y = distribution(generator) * (screenHeight / 2 - 150.0f);
+        CountryPositions[i] = CountryPositions[i] + offset;
+
+        countries[i].position = CountryPositions[i];
+        provinces[ArmyToProvinceAssignmentSystem::GetProvinceIndexForPosition(CountryPositions[i])].countryIndex = i;
+    }
+
+    validArmyIndices.resize(Constants::maxArmies);
+    std::iota(validArmyIndices.begin(), validArmyIndices.end(), 0);
+    armyIndicesAll = validArmyIndices;
+    // Many countries share the army budget instead of each getting the default amount.
+    const int initialArmiesPerCountry = Constants::initialArmiesPerCountry;
+    const int armiesPerCountry = std::min(initialArmiesPerCountry, Constants::maxArmies / countryCount);
+    validArmyIndices.resize(countryCount * armiesPerCountry);
+
+    provinceIndices.resize(provinces.size());
+    std::iota(provinceIndices.begin(), provinceIndices.end(), 0);
+
+    separationCellIndices.resize(SeparationSystem::cellCount);
+    std::iota(separationCellIndices.begin(), separationCellIndices.end(), 0);
+
+    countryIndices.resize(countryCount);
+    std::iota(countryIndices.begin(), countryIndices.end(), 0);
+
+    VectorFieldSystem::CreateDirections(provinceIndices, left, top, right, bottom);
+
+    pressure.resize(provinceIndices.size());
+    flow.resize(provinceIndices.size());
+
+    // Only needed to place the first armies.
+    ArmyVectorField initialPositions(Constants::maxArmies);
+    parallelFor(countryIndices, [&](int i)
+        {
+            const auto indices_slice = slice(validArmyIndices, i * armiesPerCountry, i * armiesPerCountry + armiesPerCountry - 1);
+            ArmySystem::SetCountryIndex(indices_slice, i, armies);
+            ArmySystem::SetValid(indices_slice, true, armies);
+            ArmySystem::SetHitPoints(indices_slice, Constants::armyInitialHitPoints, armies);
+            VectorSystem::RandomAround(indices_slice, CountryPositions[i], 150, initialPositions);
+            ArmySystem::SetPosition(indices_slice, initialPositions, armies);
+        });
+
+    armyPool.Reset((int)validArmyIndices.size());
+
+    randomVectors.resize(lean ? 2 : 5);
+    for (ArmyVectorField& randomSet : randomVectors)
+    {
+        randomSet.resize(armyIndicesAll.size());
+        VectorSystem::RandomUnit(armyIndicesAll, randomSet);
+    }
+
+    MemoryReport::Track(this, "Armies", "armies", armies);
+    MemoryReport::Track(this, "Armies", "validArmyIndices", validArmyIndices);
+    MemoryReport::Track(this, "Armies", "armyIndicesAll", armyIndicesAll);
+    MemoryReport::Track(this, "Armies", "armyPool", [this]() { return armyPool.GetMemoryBytes(); });
+    MemoryReport::Track(this, "Armies", "killedArmiesIndices", killedArmiesIndices);
+    MemoryReport::Track(this, "Assignment", "provinceBuckets", [this]() { return provinceBuckets.GetMemoryBytes(); });
+    MemoryReport::Track(this, "Assignment", "provinceToCountryAssignments", provinceToCountryAssignments);
+    MemoryReport::Track(this, "Movement", "randomVectors", [this]()
+        {
+            size_t bytes = 0;
+            for (const ArmyVectorField& randomSet : randomVectors)
+                bytes += randomSet.capacity() * sizeof(ShallowTest::Vector2);
+            return bytes;
+        });
+    MemoryReport::Track(this, "Movement", "armySeparation", armySeparation);
+    MemoryReport::Track(this, "Movement", "separationCellArmies", separationCellArmies);
+    MemoryReport::Track(this, "Movement", "separationCellPositions", separationCellPositions);
+    MemoryReport::Track(this, "Movement", "separationCellStart", separationCellStart);
+    MemoryReport::Track(this, "Movement", "navigation", [this]() { return navigation.GetMemoryBytes(); });
+    MemoryReport::Track(this, "Provinces", "provinces", provinces);
+    MemoryReport::Track(this, "Provinces", "flow", flow);
+    MemoryReport::Track(this, "Provinces", "pressure", pressure);
+    MemoryReport::Track(this, "Provinces", "neighbours", [this]() { return (left.capacity() + top.capacity() + right.capacity() + bottom.capacity()) * sizeof(int); });
+    MemoryReport::Track(this, "Countries", "countries", countries);
+}
+
+Simulation::~Simulation()
+{
+    MemoryReport::Untrack(this);
+}
+
+void Simulation::Tick(const TickInput& input)
+{
+    OPTICK_EVENT(__FUNCTION__);
+    FrameArena::BeginFrame();
+    Metrics::BeginFrame();
+    const auto tickBegin = std::chrono::steady_clock::now();
+    const FrameGovernor::Settings fidelity = governor.GetSettings();
+
+    ArmyToProvinceAssignmentSystem::ApplyCrossings(provinceIndices, validArmyIndices, armies, provinceBuckets);
+    ArmySystem::MergeKilledAndSpawned(armyIndicesAll, validArmyIndices, armies, armyPool, countries, provinceBuckets, killedArmiesIndices, spawnedArmiesCountByCountry);
+
+    ArmySystem::InitializeIndices(armyIndicesAll, validArmyIndices, armies);
+
+    SpawnSystem::UpdateFactor(countryIndices, countries, tickDeltaInS);
+
+    ArmyToProvinceAssignmentSystem::AssignArmies(provinceIndices, provinces, validArmyIndices, armies, provinceBuckets);
+
+    if (FrameGovernor::IsDue(tickIndex, fidelity.voteInterval))
+        ProvinceToCountryAssignmentSystem::AssignProvinces(countryIndices, countries, provinceIndices, provinces, provinceToCountryAssignments);
+    ArmyToCountryAssignmentSystem::AssignArmies(countryIndices, countries, validArmyIndices, armies);
+
+    if (navigationEnabled)
+        navigation.Update(tickDeltaInS, provinces, countries);
+
+    if (!armySeparationEnabled)
+        armySeparation.clear();
+    else if (FrameGovernor::IsDue(tickIndex, fidelity.separationInterval))
+    {
+        armySeparation.resize(armies.size());
+        separationCellArmies.reserve(armies.size());
+        separationCellPositions.reserve(armies.size());
+        SeparationSystem::BuildGrid(separationCellIndices, validArmyIndices, armies, separationCellStart, separationCellArmies, separationCellPositions);
+        SeparationSystem::CalcForces(separationCellIndices, separationCellStart, separationCellArmies, separationCellPositions, randomVectors[currentRandomSet], armySeparation);
+    }
+
+    const int armyStride = fidelity.armyUpdateStride;
+    ArmySystem::CalcPositionFromFlow(validArmyIndices, armies, flow, randomVectors[currentRandomSet], armySeparation, navigation.GetDirections(), provinceBuckets, tickDeltaInS, armyStride, (int)(tickIndex % armyStride));
+    CountrySystem::CalcPositionFromFlow(countryIndices, countries, flow, randomVectors[currentRandomSet], tickDeltaInS);
+
+    if (provinceMajorCombat)
+        CombatSystem::DamageArmiesByProvince(provinceIndices, provinces, provinceBuckets.GetArmies(), armies);
+    else
+        CombatSystem::DamageArmies(validArmyIndices, armies, provinces);
+    if (input.killWithinRadius)
+        CombatSystem::DamageArmiesWithinRadius(validArmyIndices, armies, input.mousePosition, input.interactionRadius);
+
+    CombatSystem::KillArmies(validArmyIndices, armies, killedArmiesIndices);
+    spawnTask.update(tickDeltaInS);
+
+    EventSystem::PublishOwnershipChanges(tickIndex, provinceIndices, provinces, publishedProvinceOwners);
+    EventSystem::PublishKills(tickIndex, killedArmiesIndices, armies, (int)countries.size());
+    EventSystem::PublishSpawns(tickIndex, spawnedArmiesCountByCountry);
+    EventSystem::PublishCountryTotals(tickIndex, countryIndices, countries);
+
+    if (input.pushWithinRadius)
+        VectorFieldSystem::CreatePressure(provinceIndices, provinces, input.mousePosition, input.interactionRadius, pressure);
+    else
+        VectorFieldSystem::ClearPressure(provinceIndices, provinces, pressure);
+
+    if (FrameGovernor::IsDue(tickIndex, fidelity.flowInterval))
+        VectorFieldSystem::CreateFlow(provinceIndices, left, top, right, bottom, pressure, flow, timePassed);
+
+    governor.TickCompleted(std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - tickBegin).count());
+    if (governor.IsEnabled())
+        Metrics::Set("Governor.Level", governor.GetLevel());
+
+    Metrics::EndFrame();
+    HardwareCounters::EndFrame((int)validArmyIndices.size());
+
+    timePassed += tickDeltaInS * 1000.0f;
+    ++tickIndex;
+    currentRandomSet = (std::rand() % (int)randomVectors.size());
+}
@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+
+#include "army_pool.h"
+#include "frame_governor.h"
+#include "game_state.h"
+#include "navigation_fields.h"
+#include "periodic_task.h"
+#include "province_buckets.h"
+#include "systems.h"
+#include "vector2.h"
+
+
+struct TickInput
+{
+	ShallowTest::Vector2 mousePosition;
+	float interactionRadius = (float)Constants::interactionRadius;
+	bool killWithinRadius = false;
+	bool pushWithinRadius = false;
+};
+
+/// World state and the system sequence of one simulation tick. Shared by the
+/// interactive loop and the headless benchmark runs.
+struct Simulation
+{
+	/// Lean keeps fewer random tables, trading some movement variety for memory.
+	explicit Simulation(float tickDeltaInS, int countryCount = Constants::maxCountries, bool lean = false);
+	~Simulation();
+	Simulation(const Simulation&) = delete;
+	Simulation& operator=(const Simulation&) = delete;
+
+	void Tick(const TickInput& input);
+
+	const float tickDeltaInS;
+	float timePassed = 0.0f;
+	unsigned int tickIndex = 0;
+	bool provinceMajorCombat = true;
+
+	// Disabled by default, so benchmarks run at full fidelity.
+	FrameGovernor governor;
+
+	// Armies push each other apart; without it they pile up on the country hubs.
+	bool armySeparationEnabled = true;
+
+	std::vector<Country> countries;
+	ArmyVector armies;
+	std::vector<Province> provinces;
+	ArmyPool armyPool;
+
+	std::vector<tArmyIndex> validArmyIndices;
+	std::vector<tArmyIndex> armyIndicesAll;
+	std::vector<tProvinceIndex> provinceIndices;
+	std::vector<tCountryIndex> countryIndices;
+
+	ProvinceBuckets provinceBuckets;
+	std::vector<tProvinceIndex> provinceToCountryAssignments;
+
+	std::vector<int> separationCellIndices;
+	std::vector<int> separationCellStart;
+	std::vector<tArmyIndex> separationCellArmies;
+	ArmyVectorField separationCellPositions;
+	// Empty while separation is disabled.
+	ArmyVectorField armySeparation;
+
+	std::vector<tArmyIndex> killedArmiesIndices;
+	std::vector<tArmyIndex> spawnedArmiesCountByCountry;
+
+	// Province owners as last reported to the EventStream.
+	std::vector<short> publishedProvinceOwners;
+
+	std::vector<int> left, top, right, bottom;
+	std::vector<float> pressure;
+	std::vector<ShallowTest::Vector2> flow;
+
+	// Declared after the neighbour lists it reads from worker threads.
+	NavigationFields navigation;
+	bool navigationEnabled = true;
+
+	// One table is picked at random every tick.
+	std::vector<ArmyVectorField> randomVectors;
+	int currentRandomSet = 0;
+
+	PeriodicTask spawnTask;
+};
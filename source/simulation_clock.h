@@ -0,0 +1,89 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+
+struct SimulationClockConfig
+{
+	float tickRate = 60.0f;
+	// Upper bound of ticks caught up in one loop iteration when the simulation falls
+	// behind real time; anything above it is dropped instead of snowballing.
+	int maxCatchUpTicks = 4;
+	// Ticks run back to back per loop iteration in fast-forward mode.
+	int fastForwardTicks = 8;
+	bool fastForward = false;
+};
+
+/// Fixed-timestep clock. In real-time mode it hands out ticks as wall time
+/// accumulates; in fast-forward mode it hands out ticks unthrottled.
+class SimulationClock
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	explicit SimulationClock(const SimulationClockConfig& config)
+		: config(config), lastUpdate(Clock::now())
+	{}
+
+	float GetTickDeltaInS() const { return 1.0f / config.tickRate; }
+	double GetSimulatedTimeInS() const { return (double)tickIndex / (double)config.tickRate; }
+	long long GetTickIndex() const { return tickIndex; }
+
+	bool IsFastForward() const { return config.fastForward; }
+	void SetFastForward(bool fastForward)
+	{
+		config.fastForward = fastForward;
+		accumulatedInS = 0.0;
+		lastUpdate = Clock::now();
+	}
+
+	/// Number of ticks due now. With paused set, wall time passes without accumulating ticks.
+	int Advance(bool paused)
+	{
+		const Clock::time_point now = Clock::now();
+		const double elapsedInS = std::chrono::duration<double>(now - lastUpdate).count();
+		lastUpdate = now;
+		this->paused = paused;
+
+		if (paused)
+		{
+			accumulatedInS = 0.0;
+			return 0;
+		}
+
+		if (config.fastForward)
+			return config.fastForwardTicks;
+
+		accumulatedInS += elapsedInS;
+		const int due = (int)(accumulatedInS * config.tickRate);
+		const int ticks = std::min(due, config.maxCatchUpTicks);
+		accumulatedInS = due > config.maxCatchUpTicks ? 0.0 : accumulatedInS - ticks * (double)GetTickDeltaInS();
+		return ticks;
+	}
+
+	void TickCompleted()
+	{
+		++tickIndex;
+	}
+
+	/// Sleeps until the next tick is due in real-time mode, and for a tick period
+	/// while paused, so a paused fast-forward does not spin.
+	void WaitForNextTick() const
+	{
+		if (config.fastForward && !paused)
+			return;
+
+		const double remainingInS = GetTickDeltaInS() - accumulatedInS;
+		if (remainingInS > 0.0)
+			std::this_thread::sleep_until(lastUpdate + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(remainingInS)));
+	}
+
+private:
+	SimulationClockConfig config;
+	Clock::time_point lastUpdate;
+	double accumulatedInS = 0.0;
+	long long tickIndex = 0;
+	// Whether the last Advance was paused.
+	bool paused = false;
+};
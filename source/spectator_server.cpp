@@ -0,0 +1,456 @@
+#include "spectator_server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "game_state.h"
+#include "optick.h"
+#include "parallel_for.h"
+#include "simulation.h"
+
+
+namespace
+{
+#if defined(_WIN32)
+	typedef SOCKET tSocket;
+	const tSocket invalidSocket = INVALID_SOCKET;
+
+	void closeSocket(tSocket socket) { closesocket(socket); }
+	bool setNonBlocking(tSocket socket) { u_long enable = 1; return ioctlsocket(socket, FIONBIO, &enable) == 0; }
+	bool wouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+	const int sendFlags = 0;
+#else
+	typedef int tSocket;
+	const tSocket invalidSocket = -1;
+
+	void closeSocket(tSocket socket) { close(socket); }
+	bool setNonBlocking(tSocket socket) { return fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK) == 0; }
+	bool wouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK; }
+#if defined(MSG_NOSIGNAL)
+	const int sendFlags = MSG_NOSIGNAL;
+#else
+	const int sendFlags = 0;
+#endif
+#endif
+
+	struct Client
+	{
+		tSocket socket = invalidSocket;
+		std::vector<unsigned char> pending;
+		size_t sent = 0;
+		bool needsKeyframe = true;
+	};
+
+	SpectatorConfig config;
+	std::vector<tSocket> listeners;
+	std::vector<Client> clients;
+	std::atomic<int> clientCount = 0;
+
+	std::atomic<bool> stopServer = false;
+
+	// Written by the simulation thread while snapshotPending is false, read by the server thread while it is true.
+	SpectatorSnapshot staging;
+	SpectatorSnapshot previous;
+	std::atomic<bool> snapshotPending = false;
+	bool hasPrevious = false;
+	int snapshotsSinceKeyframe = 0;
+
+	void writeU8(std::vector<unsigned char>& out, unsigned int value)
+	{
+		out.push_back((unsigned char)value);
+	}
+
+	void writeU32(std::vector<unsigned char>& out, unsigned int value)
+	{
+		for (int i = 0; i < 4; ++i)
+			out.push_back((unsigned char)(value >> (8 * i)));
+	}
+
+	void writeVarint(std::vector<unsigned char>& out, unsigned int value)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((unsigned char)value);
+	}
+
+	void encodeColumn(const std::vector<int>& column, const std::vector<int>* previousColumn, std::vector<unsigned char>& out)
+	{
+		const int count = (int)column.size();
+		const int previousCount = previousColumn ? (int)previousColumn->size() : 0;
+
+		int zeroRun = 0;
+		auto flushZeroRun = [&]()
+		{
+			if (zeroRun == 0)
+				return;
+			writeVarint(out, 0);
+			writeVarint(out, zeroRun);
+			zeroRun = 0;
+		};
+
+		for (int i = 0; i < count; ++i)
+		{
+			const int delta = column[i] - (i < previousCount ? (*previousColumn)[i] : 0);
+			if (delta == 0)
+			{
+				++zeroRun;
+				continue;
+			}
+
+			flushZeroRun();
+			writeVarint(out, ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 31));
+		}
+		flushZeroRun();
+	}
+
+	tSocket openTcpListener(int port)
+	{
+		tSocket listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (listener == invalidSocket)
+			return invalidSocket;
+
+		int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons((unsigned short)port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0 || !setNonBlocking(listener))
+		{
+			closeSocket(listener);
+			return invalidSocket;
+		}
+		return listener;
+	}
+
+	tSocket openUnixListener(const std::string& path)
+	{
+#if defined(_WIN32)
+		return invalidSocket;
+#else
+		sockaddr_un address = {};
+		if (path.size() >= sizeof(address.sun_path))
+			return invalidSocket;
+
+		tSocket listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener == invalidSocket)
+			return invalidSocket;
+
+		address.sun_family = AF_UNIX;
+		std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+		unlink(path.c_str());
+
+		if (bind(listener, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 8) != 0 || !setNonBlocking(listener))
+		{
+			closeSocket(listener);
+			return invalidSocket;
+		}
+		return listener;
+#endif
+	}
+
+	void acceptClients()
+	{
+		for (tSocket listener : listeners)
+		{
+			while (true)
+			{
+				const tSocket socket = accept(listener, nullptr, nullptr);
+				if (socket == invalidSocket)
+					break;
+
+				if (!setNonBlocking(socket))
+				{
+					closeSocket(socket);
+					continue;
+				}
+
+#if defined(SO_NOSIGPIPE)
+				int noSigPipe = 1;
+				setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+				Client client;
+				client.socket = socket;
+				clients.push_back(std::move(client));
+			}
+		}
+		clientCount = (int)clients.size();
+	}
+
+	void encodeAndQueue()
+	{
+		OPTICK_EVENT("SpectatorEncode");
+
+		// A scheduled keyframe goes to everyone. Otherwise clients in sync get the
+		// delta, and only new clients or ones that skipped snapshots get a
+		// keyframe. Each message is encoded at most once, and only if a client takes it.
+		const bool scheduledKeyframe = !hasPrevious || snapshotsSinceKeyframe >= config.keyframeIntervalInSnapshots;
+		snapshotsSinceKeyframe = scheduledKeyframe ? 1 : snapshotsSinceKeyframe + 1;
+
+		std::vector<unsigned char> delta;
+		std::vector<unsigned char> keyframe;
+		for (Client& client : clients)
+		{
+			if ((int)(client.pending.size() - client.sent) > config.maxClientBacklogInBytes)
+			{
+				client.needsKeyframe = true;
+				continue;
+			}
+
+			const bool sendKeyframe = scheduledKeyframe || client.needsKeyframe;
+			std::vector<unsigned char>& message = sendKeyframe ? keyframe : delta;
+			if (message.empty())
+				SpectatorServer::Encode(staging, sendKeyframe ? nullptr : &previous, message);
+
+			client.pending.insert(client.pending.end(), message.begin(), message.end());
+			client.needsKeyframe = false;
+		}
+
+		std::swap(previous, staging);
+		hasPrevious = true;
+	}
+
+	void sendPending()
+	{
+		for (Client& client : clients)
+		{
+			while (client.sent < client.pending.size())
+			{
+				const int chunk = (int)std::min<size_t>(client.pending.size() - client.sent, 1 << 20);
+				const int sent = (int)send(client.socket, (const char*)client.pending.data() + client.sent, chunk, sendFlags);
+				if (sent > 0)
+				{
+					client.sent += sent;
+					continue;
+				}
+
+				if (sent < 0 && wouldBlock())
+					break;
+
+				closeSocket(client.socket);
+				client.socket = invalidSocket;
+				break;
+			}
+
+			// Drop what was sent once it is the larger part, so a lagging client's buffer does not keep growing.
+			if (client.sent > 0 && client.sent * 2 >= client.pending.size())
+			{
+				client.pending.erase(client.pending.begin(), client.pending.begin() + client.sent);
+				client.sent = 0;
+			}
+		}
+
+		clients.erase(std::remove_if(clients.begin(), clients.end(), [](const Client& client) { return client.socket == invalidSocket; }), clients.end());
+		clientCount = (int)clients.size();
+	}
+
+	void serverLoop()
+	{
+		while (!stopServer.load(std::memory_order_acquire))
+		{
+			acceptClients();
+
+			bool worked = false;
+			if (snapshotPending.load(std::memory_order_acquire))
+			{
+				encodeAndQueue();
+				snapshotPending.store(false, std::memory_order_release);
+				worked = true;
+			}
+
+			sendPending();
+
+			if (!worked)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	// Declared after the state it uses, so the thread is joined before that is destroyed.
+	struct ServerThread
+	{
+		std::thread thread;
+
+		~ServerThread()
+		{
+			SpectatorServer::Shutdown();
+		}
+	} server;
+}
+
+bool SpectatorServer::Configure(const SpectatorConfig& newConfig)
+{
+	Shutdown();
+	config = newConfig;
+
+#if defined(_WIN32)
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return false;
+#endif
+
+	if (!config.unixSocketPath.empty())
+	{
+		const tSocket listener = openUnixListener(config.unixSocketPath);
+		if (listener == invalidSocket)
+			std::fprintf(stderr, "Spectator socket %s could not be opened\n", config.unixSocketPath.c_str());
+		else
+			listeners.push_back(listener);
+	}
+
+	if (config.tcpPort > 0)
+	{
+		const tSocket listener = openTcpListener(config.tcpPort);
+		if (listener == invalidSocket)
+			std::fprintf(stderr, "Spectator port %d could not be opened\n", config.tcpPort);
+		else
+			listeners.push_back(listener);
+	}
+
+	if (listeners.empty())
+		return false;
+
+	stopServer = false;
+	snapshotPending = false;
+	hasPrevious = false;
+	server.thread = std::thread(serverLoop);
+	return true;
+}
+
+void SpectatorServer::Shutdown()
+{
+	if (server.thread.joinable())
+	{
+		stopServer.store(true, std::memory_order_release);
+		server.thread.join();
+	}
+
+	for (Client& client : clients)
+		closeSocket(client.socket);
+	clients.clear();
+	clientCount = 0;
+
+	for (tSocket listener : listeners)
+		closeSocket(listener);
+	listeners.clear();
+
+#if !defined(_WIN32)
+	if (!config.unixSocketPath.empty())
+		unlink(config.unixSocketPath.c_str());
+#endif
+}
+
+int SpectatorServer::GetClientCount()
+{
+	return clientCount.load(std::memory_order_relaxed);
+}
+
+void SpectatorServer::TryPublish(const Simulation& simulation)
+{
+	if (clientCount.load(std::memory_order_relaxed) == 0 || snapshotPending.load(std::memory_order_acquire))
+		return;
+
+	if (config.snapshotIntervalInTicks > 1 && simulation.tickIndex % config.snapshotIntervalInTicks != 0)
+		return;
+
+	OPTICK_EVENT("SpectatorSnapshot");
+
+	staging.tick = simulation.tickIndex;
+
+	const int provinceCount = (int)simulation.provinces.size();
+	staging.provinceOwners.resize(provinceCount);
+	for (int i = 0; i < provinceCount; ++i)
+		staging.provinceOwners[i] = simulation.provinces[i].countryIndex;
+
+	const int countryCount = (int)simulation.countries.size();
+	staging.countryX.resize(countryCount);
+	staging.countryY.resize(countryCount);
+	staging.countryArmyCount.resize(countryCount);
+	staging.countryProvinceCount.resize(countryCount);
+	for (int i = 0; i < countryCount; ++i)
+	{
+		const Country& country = simulation.countries[i];
+		staging.countryX[i] = CompactArmy::Quantize(country.position.x);
+		staging.countryY[i] = CompactArmy::Quantize(country.position.y);
+		staging.countryArmyCount[i] = country.armyCount._a.load();
+		staging.countryProvinceCount[i] = country.provinceCount;
+	}
+
+	const std::vector<tArmyIndex>& armyIndices = simulation.validArmyIndices;
+	const int armyCount = (int)armyIndices.size();
+	staging.armyX.resize(armyCount);
+	staging.armyY.resize(armyCount);
+	staging.armyCountry.resize(armyCount);
+	if (armyCount > 0)
+	{
+		splitParallelFor(armyIndices, 65536, [&](auto& range, int)
+			{
+				const int begin = (int)(range.begin() - armyIndices.cbegin());
+				for (int slot = begin; slot < begin + (int)range.size(); ++slot)
+				{
+					const Army& army = simulation.armies[armyIndices[slot]];
+					const ShallowTest::Vector2 position = army.getPosition();
+					staging.armyX[slot] = (int)position.x;
+					staging.armyY[slot] = (int)position.y;
+					staging.armyCountry[slot] = army.getCountryIndex();
+				}
+			});
+	}
+
+	snapshotPending.store(true, std::memory_order_release);
+}
+
+void SpectatorServer::Encode(const SpectatorSnapshot& snapshot, const SpectatorSnapshot* previousSnapshot, std::vector<unsigned char>& out)
+{
+	const size_t messageBegin = out.size();
+	writeU32(out, 0);
+	writeU8(out, 1);
+	writeU8(out, previousSnapshot ? 0 : 1);
+	writeU32(out, snapshot.tick);
+	writeU32(out, (unsigned int)snapshot.provinceOwners.size());
+	writeU32(out, (unsigned int)snapshot.countryX.size());
+	writeU32(out, (unsigned int)snapshot.armyX.size());
+	const size_t payloadBegin = out.size();
+
+	auto column = [&](std::vector<int> SpectatorSnapshot::* member)
+	{
+		encodeColumn(snapshot.*member, previousSnapshot ? &(previousSnapshot->*member) : nullptr, out);
+	};
+
+	column(&SpectatorSnapshot::provinceOwners);
+	column(&SpectatorSnapshot::countryX);
+	column(&SpectatorSnapshot::countryY);
+	column(&SpectatorSnapshot::countryArmyCount);
+	column(&SpectatorSnapshot::countryProvinceCount);
+	column(&SpectatorSnapshot::armyX);
+	column(&SpectatorSnapshot::armyY);
+	column(&SpectatorSnapshot::armyCountry);
+
+	const unsigned int payloadSize = (unsigned int)(out.size() - payloadBegin);
+	for (int i = 0; i < 4; ++i)
+		out[messageBegin + i] = (unsigned char)(payloadSize >> (8 * i));
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+
+
+struct Simulation;
+
+struct SpectatorConfig
+{
+	// Unix domain socket path; empty disables it.
+	std::string unixSocketPath = "";
+	// TCP port bound to 127.0.0.1; 0 disables it.
+	int tcpPort = 0;
+
+	// Snapshots are taken every this many ticks, and only while a client is connected.
+	int snapshotIntervalInTicks = 6;
+	// Every this many snapshots the delta base is reset to zero.
+	int keyframeIntervalInSnapshots = 50;
+	// A client with more unsent bytes than this skips snapshots, then gets a keyframe of its own once it catches up.
+	int maxClientBacklogInBytes = 8 << 20;
+};
+
+/// World state sent to spectators, one column per field.
+/// Country positions are unsigned 11.5 fixed point, like CompactArmy; army
+/// positions are whole pixels, which keeps a tick of movement within a one byte delta.
+struct SpectatorSnapshot
+{
+	unsigned int tick = 0;
+
+	std::vector<int> provinceOwners;
+
+	std::vector<int> countryX;
+	std::vector<int> countryY;
+	std::vector<int> countryArmyCount;
+	std::vector<int> countryProvinceCount;
+
+	std::vector<int> armyX;
+	std::vector<int> armyY;
+	std::vector<int> armyCountry;
+};
+
+/// Streams the world to external viewers over a Unix domain socket and/or
+/// localhost TCP.
+///
+/// The simulation thread only copies a snapshot, and only when the server
+/// thread has finished with the previous one. Encoding and all socket I/O
+/// happen on the server thread with non-blocking sockets, so slow or stuck
+/// clients never hold up a tick.
+///
+/// Wire format, little endian, one message per snapshot:
+///   u32 payloadSize, u8 version (1), u8 flags (bit 0: keyframe), u32 tick,
+///   u32 provinceCount, u32 countryCount, u32 armyCount, payload.
+/// The payload holds the SpectatorSnapshot columns in declaration order. Each
+/// column is coded against the same column of the previous message, or
+/// against zero for keyframes and for rows past the previous length. Non-zero
+/// deltas are zigzag varints, and a 0 token is followed by a varint run length
+/// of zero deltas.
+class SpectatorServer
+{
+public:
+	/// Opens the listening sockets and starts the server thread.
+	static bool Configure(const SpectatorConfig& config);
+	static void Shutdown();
+
+	/// Called after a tick; copies the world if a snapshot is due and the server is idle.
+	static void TryPublish(const Simulation& simulation);
+
+	static int GetClientCount();
+
+	/// Appends one encoded message for snapshot, coded against previous (or zero when null).
+	static void Encode(const SpectatorSnapshot& snapshot, const SpectatorSnapshot* previous, std::vector<unsigned char>& out);
+};
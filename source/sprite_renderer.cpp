@@ -0,0 +1,337 @@
+#include "sprite_renderer.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <numeric>
+
+#include "optick.h"
+#include "parallel_for.h"
+#include "raylib_extensions.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPRITE_RENDERER_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace
+{
+	const int pointLevel = 2;
+
+	// x / 255 rounded, exact for x up to 255 * 255.
+	int div255(int x)
+	{
+		x += 128;
+		return (x + (x >> 8)) >> 8;
+	}
+
+	/// Premultiplied "over": dst = src + dst * (255 - src.a) / 255.
+	void blendRow(Color* dst, const Color* src, int count)
+	{
+		int i = 0;
+
+#if defined(SPRITE_RENDERER_SSE2)
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i rounding = _mm_set1_epi16(128);
+		const __m128i opaque = _mm_set1_epi16(255);
+		for (; i + 4 <= count; i += 4)
+		{
+			const __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+			const __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+
+			// Source alpha broadcast to the four 16 bit channels of its pixel.
+			__m128i alpha = _mm_srli_epi32(s, 24);
+			alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+			const __m128i inverseLo = _mm_sub_epi16(opaque, _mm_unpacklo_epi32(alpha, alpha));
+			const __m128i inverseHi = _mm_sub_epi16(opaque, _mm_unpackhi_epi32(alpha, alpha));
+
+			auto scale = [&](__m128i channels, __m128i inverse)
+			{
+				__m128i x = _mm_add_epi16(_mm_mullo_epi16(channels, inverse), rounding);
+				return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+			};
+
+			const __m128i lo = scale(_mm_unpacklo_epi8(d, zero), inverseLo);
+			const __m128i hi = scale(_mm_unpackhi_epi8(d, zero), inverseHi);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_adds_epu8(_mm_packus_epi16(lo, hi), s));
+		}
+#endif
+
+		for (; i < count; ++i)
+		{
+			const int inverse = 255 - src[i].a;
+			dst[i].r = (unsigned char)std::min(255, src[i].r + div255(dst[i].r * inverse));
+			dst[i].g = (unsigned char)std::min(255, src[i].g + div255(dst[i].g * inverse));
+			dst[i].b = (unsigned char)std::min(255, src[i].b + div255(dst[i].b * inverse));
+			dst[i].a = (unsigned char)std::min(255, src[i].a + div255(dst[i].a * inverse));
+		}
+	}
+}
+
+SpriteRenderer::SpriteRenderer(const Image& sprite, const std::vector<Color>& countryColors, const SpriteRendererConfig& config)
+	: config(config)
+{
+	this->config.halfSpriteMaxCount = std::max(config.fullSpriteMaxCount, config.halfSpriteMaxCount);
+
+	const int countryCount = (int)countryColors.size();
+	tileIndices.resize(tileCount);
+	std::iota(tileIndices.begin(), tileIndices.end(), 0);
+	tileSprites.resize(tileCount);
+	cellCounts.resize(cellsX * cellsY);
+
+	// Without a sprite every army is a point.
+	if (sprite.data == nullptr || sprite.width <= 0 || sprite.height <= 0)
+		return;
+
+	// Full size: the sprite tinted by the country color, with alpha premultiplied.
+	const Color* source = (const Color*)sprite.data;
+	const int spritePixelCount = sprite.width * sprite.height;
+	Mip full{ sprite.width, sprite.height, {} };
+	full.pixels.resize((size_t)countryCount * spritePixelCount);
+	for (int country = 0; country < countryCount; ++country)
+	{
+		const Color tint = countryColors[country];
+		Color* output = full.pixels.data() + (size_t)country * spritePixelCount;
+		for (int pixel = 0; pixel < spritePixelCount; ++pixel)
+		{
+			const Color s = source[pixel];
+			output[pixel] = {
+				(unsigned char)div255(div255(s.r * tint.r) * s.a),
+				(unsigned char)div255(div255(s.g * tint.g) * s.a),
+				(unsigned char)div255(div255(s.b * tint.b) * s.a),
+				s.a };
+		}
+	}
+	mips.push_back(std::move(full));
+
+	// Half size: 2x2 box filter, which is exact on premultiplied colors.
+	if (sprite.width >= 2 && sprite.height >= 2)
+	{
+		const Mip& parent = mips[0];
+		Mip half{ parent.width / 2, parent.height / 2, {} };
+		const int halfPixelCount = half.width * half.height;
+		half.pixels.resize((size_t)countryCount * halfPixelCount);
+		for (int country = 0; country < countryCount; ++country)
+		{
+			const Color* input = parent.pixels.data() + (size_t)country * spritePixelCount;
+			Color* output = half.pixels.data() + (size_t)country * halfPixelCount;
+			for (int y = 0; y < half.height; ++y)
+			{
+				for (int x = 0; x < half.width; ++x)
+				{
+					const Color* quad = input + 2 * y * parent.width + 2 * x;
+					auto average = [&](unsigned char Color::* channel)
+					{
+						return (unsigned char)((quad[0].*channel + quad[1].*channel + quad[parent.width].*channel + quad[parent.width + 1].*channel + 2) / 4);
+					};
+					output[y * half.width + x] = { average(&Color::r), average(&Color::g), average(&Color::b), average(&Color::a) };
+				}
+			}
+		}
+		mips.push_back(std::move(half));
+	}
+
+	// A sprite reaches ceil(size / 2) pixels from its army.
+	const int extent = (std::max(sprite.width, sprite.height) + 1) / 2;
+	tileReach = (extent + tileSize - 1) / tileSize;
+}
+
+void SpriteRenderer::Draw(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies, const std::vector<Color>& countryColors, std::vector<Color>& pixels)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	assert(pixels.size() >= Constants::screenWidth * Constants::screenHeight);
+
+	bin(armyIndices, armies);
+	chooseLevels();
+
+	{
+		OPTICK_EVENT("Blend");
+		parallelFor(tileIndices, [&](int tileIndex)
+			{
+				drawTile(tileIndex, countryColors, pixels);
+			});
+	}
+}
+
+size_t SpriteRenderer::GetMemoryBytes() const
+{
+	size_t bytes = tileIndices.capacity() * sizeof(int) + batchOffsets.capacity() * sizeof(int) + tileStart.capacity() * sizeof(int)
+		+ entries.capacity() * sizeof(Entry) + cellCounts.capacity() * sizeof(uint32_t);
+	for (const Mip& mip : mips)
+		bytes += mip.pixels.capacity() * sizeof(Color);
+	for (const std::vector<Entry>& sprites : tileSprites)
+		bytes += sprites.capacity() * sizeof(Entry);
+	return bytes;
+}
+
+void SpriteRenderer::bin(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies)
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	auto tileFor = [](int x, int y)
+	{
+		return (y / tileSize) * tilesX + x / tileSize;
+	};
+
+	auto pixelFor = [](const ShallowTest::Vector2& position, int& x, int& y)
+	{
+		x = std::clamp((int)position.x, 0, Constants::screenWidth - 1);
+		y = std::clamp((int)position.y, 0, Constants::screenHeight - 1);
+	};
+
+	// Counting sort by tile, parallel the same way as SeparationSystem::BuildGrid.
+	const int batchSize = 65535;
+	const int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
+	batchOffsets.assign((size_t)tileCount * batchCount, 0);
+
+	splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+		{
+			int* counts = batchOffsets.data() + batchIndex * tileCount;
+			for (int i : range)
+			{
+				int x, y;
+				pixelFor(armies[i].getPosition(), x, y);
+				++counts[tileFor(x, y)];
+			}
+		});
+
+	tileStart.resize(tileCount + 1);
+	int totalCount = 0;
+	for (int tile = 0; tile < tileCount; ++tile)
+	{
+		tileStart[tile] = totalCount;
+		for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+		{
+			int& batchOffset = batchOffsets[batchIndex * tileCount + tile];
+			const int count = batchOffset;
+			batchOffset = totalCount;
+			totalCount += count;
+		}
+	}
+	tileStart[tileCount] = totalCount;
+	entries.resize(totalCount);
+
+	splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+		{
+			int* offsets = batchOffsets.data() + batchIndex * tileCount;
+			for (int i : range)
+			{
+				int x, y;
+				pixelFor(armies[i].getPosition(), x, y);
+				entries[offsets[tileFor(x, y)]++] = { (uint16_t)x, (uint16_t)y, (uint16_t)armies[i].getCountryIndex(), 0 };
+			}
+		});
+
+	// Density cells never straddle tiles, so every tile counts its own cells.
+	static_assert(tileSize % cellSize == 0);
+	parallelFor(tileIndices, [&](int tile)
+		{
+			const int cellX = (tile % tilesX) * (tileSize / cellSize);
+			const int cellY = (tile / tilesX) * (tileSize / cellSize);
+			for (int y = cellY; y < std::min(cellsY, cellY + tileSize / cellSize); ++y)
+			{
+				for (int x = cellX; x < std::min(cellsX, cellX + tileSize / cellSize); ++x)
+					cellCounts[y * cellsX + x] = 0;
+			}
+
+			for (int e = tileStart[tile]; e < tileStart[tile + 1]; ++e)
+				++cellCounts[(entries[e].y / cellSize) * cellsX + entries[e].x / cellSize];
+		});
+}
+
+void SpriteRenderer::chooseLevels()
+{
+	OPTICK_EVENT(__FUNCTION__);
+
+	fullSpriteMaxCount = mips.size() > 0 ? config.fullSpriteMaxCount : 0;
+	halfSpriteMaxCount = mips.size() > 1 ? config.halfSpriteMaxCount : fullSpriteMaxCount;
+
+	// armiesUpTo[c]: armies in cells holding at most c armies, so the pixel cost
+	// of any pair of limits is two lookups.
+	std::vector<long long> armiesUpTo(halfSpriteMaxCount + 1, 0);
+	for (uint32_t count : cellCounts)
+	{
+		if ((int)count <= halfSpriteMaxCount)
+			armiesUpTo[count] += count;
+	}
+	std::partial_sum(armiesUpTo.begin(), armiesUpTo.end(), armiesUpTo.begin());
+
+	const long long fullArea = mips.size() > 0 ? (long long)mips[0].width * mips[0].height : 0;
+	const long long halfArea = mips.size() > 1 ? (long long)mips[1].width * mips[1].height : fullArea;
+	auto cost = [&]()
+	{
+		return armiesUpTo[fullSpriteMaxCount] * fullArea + (armiesUpTo[halfSpriteMaxCount] - armiesUpTo[fullSpriteMaxCount]) * halfArea;
+	};
+
+	// Halving the limits drops the densest sprite cells to the next level first.
+	while (halfSpriteMaxCount > 0 && cost() > config.pixelBudget)
+	{
+		fullSpriteMaxCount /= 2;
+		halfSpriteMaxCount /= 2;
+	}
+
+	pixelCost = cost();
+
+	parallelFor(tileIndices, [&](int tile)
+		{
+			std::vector<Entry>& sprites = tileSprites[tile];
+			sprites.clear();
+			for (int e = tileStart[tile]; e < tileStart[tile + 1]; ++e)
+			{
+				Entry& entry = entries[e];
+				const int count = (int)cellCounts[(entry.y / cellSize) * cellsX + entry.x / cellSize];
+				entry.level = (uint16_t)(count <= fullSpriteMaxCount ? 0 : count <= halfSpriteMaxCount ? 1 : pointLevel);
+				if (entry.level < pointLevel)
+					sprites.push_back(entry);
+			}
+		});
+}
+
+void SpriteRenderer::drawTile(int tileIndex, const std::vector<Color>& countryColors, std::vector<Color>& pixels) const
+{
+	const int tileX = tileIndex % tilesX;
+	const int tileY = tileIndex / tilesX;
+	const int left = tileX * tileSize;
+	const int top = tileY * tileSize;
+	const int right = std::min((int)Constants::screenWidth, left + tileSize);
+	const int bottom = std::min((int)Constants::screenHeight, top + tileSize);
+
+	// Points first, so sprites of sparse neighbours stay on top.
+	for (int e = tileStart[tileIndex]; e < tileStart[tileIndex + 1]; ++e)
+	{
+		const Entry& entry = entries[e];
+		if (entry.level != pointLevel)
+			continue;
+
+		Color c = countryColors[entry.countryIndex];
+		c.a = 150;
+		pixels[entry.y * Constants::screenWidth + entry.x] += c;
+	}
+
+	for (int y = std::max(0, tileY - tileReach); y <= std::min(tilesY - 1, tileY + tileReach); ++y)
+	{
+		for (int x = std::max(0, tileX - tileReach); x <= std::min(tilesX - 1, tileX + tileReach); ++x)
+		{
+			for (const Entry& sprite : tileSprites[y * tilesX + x])
+			{
+				const Mip& mip = mips[sprite.level];
+				const int spriteLeft = sprite.x - mip.width / 2;
+				const int spriteTop = sprite.y - mip.height / 2;
+				const int beginX = std::max(left, spriteLeft);
+				const int endX = std::min(right, spriteLeft + mip.width);
+				const int beginY = std::max(top, spriteTop);
+				const int endY = std::min(bottom, spriteTop + mip.height);
+				if (beginX >= endX || beginY >= endY)
+					continue;
+
+				const Color* spritePixels = mip.pixels.data() + (size_t)sprite.countryIndex * mip.width * mip.height;
+				for (int line = beginY; line < endY; ++line)
+				{
+					blendRow(pixels.data() + line * Constants::screenWidth + beginX,
+						spritePixels + (line - spriteTop) * mip.width + (beginX - spriteLeft), endX - beginX);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "constants.h"
+#include "game_state.h"
+#include "raylib.h"
+
+
+struct SpriteRendererConfig
+{
+	// Armies in a density cell holding at most this many armies get the full sprite,
+	int fullSpriteMaxCount = 2;
+	// up to this many the half size sprite; denser cells are drawn as single points.
+	int halfSpriteMaxCount = 12;
+	// Sprite pixels blended per frame; the counts above are lowered until a frame fits.
+	int pixelBudget = 4 << 20;
+};
+
+/// Alternate army render mode drawing each army as its country's star. The
+/// level of detail follows the local army density: full sprites where armies
+/// are sparse, a half size mip at medium density and single points in dense
+/// regions, so blending cost is bounded by the pixel budget however many armies
+/// there are. Sprites are pre-tinted per country with premultiplied alpha, and
+/// the screen is drawn in tiles on the pool threads, each tile clipping the
+/// sprites that reach into it, so no two threads write the same pixel.
+class SpriteRenderer
+{
+public:
+	SpriteRenderer(const Image& sprite, const std::vector<Color>& countryColors, const SpriteRendererConfig& config);
+
+	/// Draws the armies over the screen sized pixel buffer.
+	void Draw(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies, const std::vector<Color>& countryColors, std::vector<Color>& pixels);
+
+	/// Sprite pixels blended by the last Draw, and the density limit for half size sprites it settled on.
+	long long GetPixelCost() const { return pixelCost; }
+	int GetHalfSpriteMaxCount() const { return halfSpriteMaxCount; }
+
+	size_t GetMemoryBytes() const;
+
+private:
+	static const int tileSize = 64;
+	static const int cellSize = 16;
+	static const int tilesX = (Constants::screenWidth + tileSize - 1) / tileSize;
+	static const int tilesY = (Constants::screenHeight + tileSize - 1) / tileSize;
+	static const int tileCount = tilesX * tilesY;
+	static constexpr int cellsX = (Constants::screenWidth + cellSize - 1) / cellSize;
+	static constexpr int cellsY = (Constants::screenHeight + cellSize - 1) / cellSize;
+
+	// One pre-tinted sprite per country, stored back to back.
+	struct Mip
+	{
+		int width;
+		int height;
+		std::vector<Color> pixels;
+	};
+
+	struct Entry
+	{
+		uint16_t x;
+		uint16_t y;
+		uint16_t countryIndex;
+		uint16_t level;
+	};
+
+	void bin(const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies);
+	void chooseLevels();
+	void drawTile(int tileIndex, const std::vector<Color>& countryColors, std::vector<Color>& pixels) const;
+
+	SpriteRendererConfig config;
+	std::vector<Mip> mips;
+	// Tiles a sprite can reach into on each side of its own.
+	int tileReach = 0;
+
+	std::vector<int> tileIndices;
+	std::vector<int> batchOffsets;
+	std::vector<int> tileStart;
+	std::vector<Entry> entries;
+	std::vector<uint32_t> cellCounts;
+	std::vector<std::vector<Entry>> tileSprites;
+
+	// Density limits of this frame, after fitting the pixel budget.
+	int fullSpriteMaxCount = 0;
+	int halfSpriteMaxCount = 0;
+	long long pixelCost = 0;
+};
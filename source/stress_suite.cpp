@@ -0,0 +1,302 @@
+#include "stress_suite.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include "grid.h"
+#include "hardware_counters.h"
+#include "memory_report.h"
+#include "metrics.h"
+#include "options.h"
+#include "parallel_for.h"
+#include "simulation.h"
+#include "spectator_server.h"
+#include "thread_pool.h"
+
+
+namespace
+{
+	const unsigned int seed = 1234;
+
+	struct Scenario
+	{
+		const char* name;
+		const char* description;
+		// 0 models the paused game, which still hands state to the drawing thread.
+		int ticksPerFrame;
+		// Called once after the world is built.
+		std::function<void(Simulation&)> prepare;
+		// Called before every frame; returns the mouse input of its ticks.
+		std::function<TickInput(Simulation&)> beforeFrame;
+	};
+
+	struct Result
+	{
+		std::string name;
+		double p50InMs;
+		double p95InMs;
+		double p99InMs;
+		double maxInMs;
+		double peakResidentInMB;
+	};
+
+	// The buffers the drawing thread copies every frame, see CopyState in mainDraw.
+	struct StateCopy
+	{
+		std::vector<tArmyIndex> armyIndices;
+		ArmyVector armies;
+		std::vector<Province> provinces;
+		std::vector<Country> countries;
+		std::vector<ShallowTest::Vector2> flow;
+	};
+
+	const ShallowTest::Vector2 screenCenter = { Constants::screenWidth * 0.5f, Constants::screenHeight * 0.5f };
+
+	void pinCountries(Simulation& simulation, ShallowTest::Vector2 position)
+	{
+		for (Country& country : simulation.countries)
+			country.position = position;
+	}
+
+	std::vector<Scenario> makeScenarios()
+	{
+		return {
+			{ "spawn-point", "every country and army piled up on one point, spawning there", 1,
+				[](Simulation& simulation)
+				{
+					ArmyVectorField positions(simulation.armies.size());
+					VectorSystem::RandomAround(simulation.validArmyIndices, screenCenter, 40, positions);
+					ArmySystem::SetPosition(simulation.validArmyIndices, positions, simulation.armies);
+					pinCountries(simulation, screenCenter);
+				},
+				[](Simulation& simulation)
+				{
+					pinCountries(simulation, screenCenter);
+					return TickInput();
+				} },
+			{ "saturated-combat", "full world with armies fighting along every border", 1,
+				[](Simulation&) {},
+				[](Simulation&) { return TickInput(); } },
+			{ "mouse-kill-push", "mouse held down to kill and push over the densest province", 1,
+				[](Simulation&) {},
+				[](Simulation& simulation)
+				{
+					const auto densest = std::max_element(simulation.provinces.begin(), simulation.provinces.end(), [](const Province& a, const Province& b)
+						{
+							return a.armyCount._a.load() < b.armyCount._a.load();
+						});
+					const GridGeometry& grid = GridGeometry::Get();
+					const float halfProvince = grid.provinceSize * 0.5f;
+					const ShallowTest::Vector2 corner = grid.GetPositionFromProvinceIndex((int)(densest - simulation.provinces.begin()));
+
+					TickInput input;
+					input.mousePosition = { corner.x + halfProvince, corner.y + halfProvince };
+					input.killWithinRadius = true;
+					input.pushWithinRadius = true;
+					return input;
+				} },
+			{ "paused", "space held down: no ticks, only the state copy", 0,
+				[](Simulation&) {},
+				[](Simulation&) { return TickInput(); } },
+		};
+	}
+
+	void copyState(const Simulation& simulation, StateCopy& copy)
+	{
+		copy.armyIndices = simulation.validArmyIndices;
+		copy.armies.resize(copy.armyIndices.size());
+		copy.provinces.resize(simulation.provinceIndices.size());
+		copy.countries.resize(simulation.countryIndices.size());
+		copy.flow.resize(simulation.provinceIndices.size());
+		slice(simulation.armies, 0, (int)copy.armyIndices.size() - 1, copy.armies);
+		slice(simulation.provinces, 0, (int)copy.provinces.size() - 1, copy.provinces);
+		slice(simulation.countries, 0, (int)copy.countries.size() - 1, copy.countries);
+		slice(simulation.flow, 0, (int)copy.flow.size() - 1, copy.flow);
+	}
+
+	double percentile(const std::vector<double>& sorted, double p)
+	{
+		return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+	}
+
+	Result runScenario(const Scenario& scenario, const AppOptions& options)
+	{
+		const StressSuiteConfig& config = options.stress;
+
+		// Each scenario measures its own peak instead of the high-water mark of the
+		// scenarios before it. Without a reset, the resident size sampled every frame is used.
+		const bool peakReset = MemoryReport::ResetPeakResidentBytes();
+
+		std::srand(seed);
+		if (options.interleaveMemory)
+			ThreadPool::SetInterleavedMemory(true);
+		Simulation simulation(1.0f / options.clock.tickRate, options.countryCount, options.lean);
+		if (options.interleaveMemory)
+			ThreadPool::SetInterleavedMemory(false);
+		simulation.armySeparationEnabled = options.armySeparation;
+		simulation.navigationEnabled = options.navigation;
+		scenario.prepare(simulation);
+
+		StateCopy copy;
+		std::vector<double> frameTimes;
+		size_t peakResidentBytes = MemoryReport::GetResidentBytes();
+
+		for (int frame = 0; frame < config.warmUpFrames + config.frames; ++frame)
+		{
+			const TickInput input = scenario.beforeFrame(simulation);
+
+			const auto begin = std::chrono::steady_clock::now();
+			for (int tick = 0; tick < scenario.ticksPerFrame; ++tick)
+			{
+				simulation.Tick(input);
+				SpectatorServer::TryPublish(simulation);
+			}
+			copyState(simulation, copy);
+			const auto end = std::chrono::steady_clock::now();
+
+			if (frame >= config.warmUpFrames)
+				frameTimes.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+			peakResidentBytes = std::max(peakResidentBytes, MemoryReport::GetResidentBytes());
+		}
+
+		if (peakReset)
+			peakResidentBytes = std::max(peakResidentBytes, MemoryReport::GetPeakResidentBytes());
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		return { scenario.name, percentile(frameTimes, 0.5), percentile(frameTimes, 0.95), percentile(frameTimes, 0.99), frameTimes.back(),
+			(double)peakResidentBytes / (1024.0 * 1024.0) };
+	}
+
+	std::vector<Result> readBaselines(const std::string& path)
+	{
+		std::vector<Result> baselines;
+		std::FILE* file = std::fopen(path.c_str(), "r");
+		if (!file)
+			return baselines;
+
+		char line[256];
+		while (std::fgets(line, sizeof(line), file))
+		{
+			char name[64];
+			Result result;
+			if (std::sscanf(line, "%63[^,],%lf,%lf,%lf,%lf,%lf", name, &result.p50InMs, &result.p95InMs, &result.p99InMs, &result.maxInMs, &result.peakResidentInMB) == 6)
+			{
+				result.name = name;
+				baselines.push_back(result);
+			}
+		}
+		std::fclose(file);
+		return baselines;
+	}
+
+	bool writeBaselines(const std::string& path, const std::vector<Result>& results)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+
+		std::fprintf(file, "scenario,p50 ms,p95 ms,p99 ms,max ms,peak resident MB\n");
+		for (const Result& result : results)
+			std::fprintf(file, "%s,%.3f,%.3f,%.3f,%.3f,%.1f\n", result.name.c_str(), result.p50InMs, result.p95InMs, result.p99InMs, result.maxInMs, result.peakResidentInMB);
+		std::fclose(file);
+		return true;
+	}
+
+	// The slowest systems of the scenario, to point at what regressed. Frame
+	// totals and derived series such as task intervals and latencies are skipped.
+	void printSlowestSystems()
+	{
+		std::vector<MetricsSummary> summary = Metrics::GetSummary();
+		summary.erase(std::remove_if(summary.begin(), summary.end(), [](const MetricsSummary& s)
+			{
+				return std::strcmp(s.name, "Frame") == 0 || std::strcmp(s.name, "FrameJitter") == 0 || std::strchr(s.name, '.') != nullptr;
+			}), summary.end());
+		std::sort(summary.begin(), summary.end(), [](const MetricsSummary& a, const MetricsSummary& b) { return a.p95InMs > b.p95InMs; });
+
+		for (int i = 0; i < std::min(5, (int)summary.size()); ++i)
+			std::printf("    %-52s p95 %.3f ms\n", summary[i].name, summary[i].p95InMs);
+	}
+}
+
+int runStressSuite(const AppOptions& options)
+{
+	const StressSuiteConfig& config = options.stress;
+
+	std::vector<Scenario> scenarios = makeScenarios();
+	if (config.scenario != "all")
+	{
+		scenarios.erase(std::remove_if(scenarios.begin(), scenarios.end(), [&](const Scenario& s) { return config.scenario != s.name; }), scenarios.end());
+		if (scenarios.empty())
+		{
+			std::fprintf(stderr, "Unknown stress scenario: %s\n", config.scenario.c_str());
+			return 2;
+		}
+	}
+
+	// Metrics keep exactly the frames of the running scenario.
+	MetricsConfig metricsConfig;
+	metricsConfig.windowInFrames = std::max(1, config.frames);
+	metricsConfig.exportIntervalInS = 0.0f;
+	Metrics::Configure(metricsConfig);
+
+	std::vector<Result> baselines = readBaselines(config.baselinePath);
+	std::vector<Result> results;
+	int failedCount = 0;
+
+	std::printf("scenario, p50 ms, p95 ms, p99 ms, max ms, peak resident MB, result\n");
+	for (const Scenario& scenario : scenarios)
+	{
+		const Result result = runScenario(scenario, options);
+		results.push_back(result);
+
+		const auto baseline = std::find_if(baselines.begin(), baselines.end(), [&](const Result& b) { return b.name == result.name; });
+		const char* verdict = "no baseline";
+		bool failed = false;
+		if (config.updateBaselines)
+			verdict = "recorded";
+		else if (baseline != baselines.end())
+		{
+			failed = result.p50InMs > baseline->p50InMs * config.timeThreshold
+				|| result.p95InMs > baseline->p95InMs * config.timeThreshold
+				|| result.p99InMs > baseline->p99InMs * config.timeThreshold
+				|| result.peakResidentInMB > baseline->peakResidentInMB * config.memoryThreshold;
+			verdict = failed ? "FAILED" : "ok";
+		}
+
+		std::printf("%s, %.3f, %.3f, %.3f, %.3f, %.1f, %s\n", result.name.c_str(), result.p50InMs, result.p95InMs, result.p99InMs, result.maxInMs, result.peakResidentInMB, verdict);
+		if (failed)
+		{
+			++failedCount;
+			std::printf("  %s; baseline p50 %.3f, p95 %.3f, p99 %.3f ms, peak %.1f MB\n", scenario.description,
+				baseline->p50InMs, baseline->p95InMs, baseline->p99InMs, baseline->peakResidentInMB);
+			if (scenario.ticksPerFrame > 0)
+				printSlowestSystems();
+		}
+		if (HardwareCounters::IsEnabled() && scenario.ticksPerFrame > 0)
+			HardwareCounters::Print(stdout);
+		std::fflush(stdout);
+	}
+
+	if (config.updateBaselines)
+	{
+		// Scenarios that were not run keep their old baselines.
+		for (const Result& baseline : baselines)
+		{
+			if (std::none_of(results.begin(), results.end(), [&](const Result& r) { return r.name == baseline.name; }))
+				results.push_back(baseline);
+		}
+
+		if (!writeBaselines(config.baselinePath, results))
+		{
+			std::fprintf(stderr, "Cannot write stress baselines to %s\n", config.baselinePath.c_str());
+			return 2;
+		}
+	}
+
+	return failedCount > 0 ? 1 : 0;
+}
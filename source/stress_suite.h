@@ -0,0 +1,28 @@
+#pragma once
+#include <string>
+
+
+struct AppOptions;
+
+struct StressSuiteConfig
+{
+	// Scenario to run, or "all"; empty runs the game instead.
+	std::string scenario;
+	int frames = 300;
+	int warmUpFrames = 30;
+	// CSV of frame time percentiles and peak memory per scenario.
+	std::string baselinePath = "stress_baselines.csv";
+	// Record the results as the new baselines instead of comparing.
+	bool updateBaselines = false;
+	// A scenario fails when a frame time percentile exceeds its baseline by
+	// this factor, or the peak resident size exceeds its baseline by memoryThreshold.
+	float timeThreshold = 1.25f;
+	float memoryThreshold = 1.10f;
+};
+
+/// Runs stress scenarios headless through the frame sequence of the game
+/// loop: simulation ticks, spectator publishing and the drawing thread's state
+/// copy. Reports frame time percentiles and peak resident memory per scenario
+/// and compares them against the stored baselines.
+/// Returns nonzero when a scenario regressed past the thresholds.
+int runStressSuite(const AppOptions& options);
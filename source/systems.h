@@ -1,19 +1,26 @@
 #pragma once
 #include <algorithm>
 #include <assert.h>
-#include <execution>
-#include <functional>
+#include <memory_resource>
 #include <numeric>
 
+#include "army_pool.h"
+#include "event_stream.h"
+#include "frame_arena.h"
 #include "game_state.h"
+#include "grid.h"
+#include "instrumentation.h"
+#include "navigation_fields.h"
 #include "optick.h"
 #include "parallel_for.h"
+#include "province_buckets.h"
 #include "vector2.h"
+#include "vector_expressions.h"
 
 
 struct VectorSystem
 {
-	static void RandomUnit(const std::vector<int>& indices, std::vector<ShallowTest::Vector2>& inputoutput)
+	static void RandomUnit(const std::vector<int>& indices, ArmyVectorField& inputoutput)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -22,35 +29,36 @@ struct VectorSystem
 			});
 	}
 
-	static void MulByFloat(const std::vector<int>& indices, const std::vector<float>& floats, std::vector<ShallowTest::Vector2>& inputoutput)
+	/// output[i] = expression[i] in one fused pass, see VectorExpressions. Chains
+	/// such as normalize(column(a)) * column(speed) + column(b) go here rather than
+	/// through the single step helpers below, which each make a pass of their own.
+	template<class Output, class Expression>
+	static void Evaluate(const std::vector<int>& indices, Output& output, const Expression& expression)
 	{
 		OPTICK_EVENT(__FUNCTION__);
-		parallelFor(indices, [&](int i)
-			{
-				inputoutput[i] = inputoutput[i] * floats[i];
-			});
+		VectorExpressions::evaluate(indices, output, expression);
+	}
+
+	static void MulByFloat(const std::vector<int>& indices, const std::vector<float>& floats, std::vector<ShallowTest::Vector2>& inputoutput)
+	{
+		using namespace VectorExpressions;
+		Evaluate(indices, inputoutput, column(inputoutput) * column(floats));
 	}
 
 	static void Add(const std::vector<int>& indices, std::vector<ShallowTest::Vector2>& v1, const std::vector<ShallowTest::Vector2>& v2)
 	{
-		OPTICK_EVENT(__FUNCTION__);
-		parallelFor(indices, [&](int i)
-			{
-				v1[i] = v1[i] + v2[i];
-			});
+		using namespace VectorExpressions;
+		Evaluate(indices, v1, column(v1) + column(v2));
 	}
 
 	static void Normalize(const std::vector<int>& indices, std::vector<ShallowTest::Vector2>& vectors)
 	{
-		OPTICK_EVENT(__FUNCTION__);
-		parallelFor(indices, [&](int i)
-			{
-				vectors[i].SafeNormalize();
-			});
+		using namespace VectorExpressions;
+		Evaluate(indices, vectors, normalize(column(vectors)));
 	}
 
 
-	static void RandomAround(const std::vector<int>& indices, const ShallowTest::Vector2& position, float radius, std::vector<ShallowTest::Vector2>& output)
+	static void RandomAround(const std::vector<int>& indices, const ShallowTest::Vector2& position, float radius, ArmyVectorField& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -70,36 +78,48 @@ struct VectorFieldSystem
 		right.resize(indices.size());
 		bottom.resize(indices.size());
 
-		const int cellCount = Constants::gridWidth * Constants::gridHeight;
-
-		parallelFor(indices, [&](int i)
+		dispatchGrid(GridGeometry::Get(), [&](const auto& grid)
 			{
-				left[i] = (i % Constants::gridWidth) == 0 ? -1 : i - 1;
-				top[i] = (i - Constants::gridWidth) < 0 ? -1 : i - Constants::gridWidth;
-				right[i] = ((i + 1) % Constants::gridWidth) == 0 ? -1 : i + 1;
-				bottom[i] = (i + Constants::gridWidth) >= cellCount ? -1 : i + Constants::gridHeight;
+				const int cellCount = grid.GetProvinceCount();
+				const int gridWidth = grid.GetWidth();
+
+				parallelFor(indices, [&](int i)
+					{
+						const int x = grid.GetX(i);
+						left[i] = x == 0 ? -1 : i - 1;
+						top[i] = (i - gridWidth) < 0 ? -1 : i - gridWidth;
+						right[i] = x == gridWidth - 1 ? -1 : i + 1;
+						bottom[i] = (i + gridWidth) >= cellCount ? -1 : i + gridWidth;
+					});
 			});
 
 	}
 
-	static void CreatePressure(const std::vector<int>& indices, const std::vector<Province>& provinces, const ShallowTest::Vector2 position, float radius, std::vector<float>& pressure)
+	static void CreatePressure(const std::vector<int>& indices, const std::vector<Province>& /*provinces*/, const ShallowTest::Vector2 position, float radius, std::vector<float>& pressure)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("VectorFieldSystem::CreatePressure");
 
 		pressure.resize(indices.size());
-		parallelFor(indices, [&](int i)
+		dispatchGrid(GridGeometry::Get(), [&](const auto& grid)
 			{
-				float y = (float)(i / Constants::gridWidth);
-				float x = (float)(i - y * Constants::gridWidth);
-		
-				ShallowTest::Vector2 thisPosition{ x * Constants::provinceSize + Constants::provinceSize / 2, y * Constants::provinceSize + Constants::provinceSize / 2 };
-				pressure[i] = std::clamp((thisPosition - position).Length(), 0.0f, radius);
+				const int provinceSize = grid.GetProvinceSize();
+
+				parallelFor(indices, [&](int i)
+					{
+						float y = (float)grid.GetY(i);
+						float x = (float)grid.GetX(i);
+
+						ShallowTest::Vector2 thisPosition{ x * provinceSize + provinceSize / 2, y * provinceSize + provinceSize / 2 };
+						pressure[i] = std::clamp((thisPosition - position).Length(), 0.0f, radius);
+					});
 			});
 	}
 
-	static void ClearPressure(const std::vector<int>& indices, const std::vector<Province>& provinces, std::vector<float>& pressure)
+	static void ClearPressure(const std::vector<int>& indices, const std::vector<Province>& /*provinces*/, std::vector<float>& pressure)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("VectorFieldSystem::ClearPressure");
 
 		pressure.resize(indices.size());
 		parallelFor(indices, [&](int i)
@@ -112,194 +132,409 @@ struct VectorFieldSystem
 		const std::vector<float>& pressure, std::vector<ShallowTest::Vector2>& flow, float time)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("VectorFieldSystem::CreateFlow");
 		ShallowTest::Vector2 left{ -1, 0 };
 		ShallowTest::Vector2 top{ 0, -1 };
 		ShallowTest::Vector2 right{ 1, 0 };
 		ShallowTest::Vector2 bottom{ 0, 1 };
 
+		const float factor1 = std::cos(2 * time / 1000.0f);
+		const float factor2 = std::sin(time / 1000.0f);
+
 		flow.resize(indices.size());
-		parallelFor(indices, [&](int i)
+		dispatchGrid(GridGeometry::Get(), [&](const auto& grid)
 			{
-				float thisPressure = pressure[i];
-				int y = i / Constants::gridWidth;
-				int x = i - y * Constants::gridWidth;
-
-				float horizontalFactor = (float)x / (float)Constants::gridWidth;
-				float verticalFactor = (float)y / (float)Constants::gridHeight;
-				float factor1 = std::cos(2 * time / 1000.0f);
-				float factor2 = std::sin(time / 1000.0f);
-				float verticalMult = std::cos((horizontalFactor) * 3.14f + factor2) + std::cos(verticalFactor * 3.14f);
-				float horizontalMult = std::sin((verticalFactor) * 3.14f - 3.14f / 2.0f + factor1) + std::cos(horizontalFactor * 3.14f);
-
-				float leftMult = 0.0f;
-				float rightMult = horizontalMult;
-				float bottomMult = verticalMult;
-				float topMult = 0.0f;
+				parallelFor(indices, [&](int i)
+					{
+						float thisPressure = pressure[i];
+						int y = grid.GetY(i);
+						int x = grid.GetX(i);
+
+						float horizontalFactor = (float)x * grid.GetInvWidth();
+						float verticalFactor = (float)y * grid.GetInvHeight();
+						float verticalMult = std::cos((horizontalFactor) * 3.14f + factor2) + std::cos(verticalFactor * 3.14f);
+						float horizontalMult = std::sin((verticalFactor) * 3.14f - 3.14f / 2.0f + factor1) + std::cos(horizontalFactor * 3.14f);
+
+						float leftMult = 0.0f;
+						float rightMult = horizontalMult;
+						float bottomMult = verticalMult;
+						float topMult = 0.0f;
 				
-				ShallowTest::Vector2 leftFlow = left * (leftIndices[i] == -1 ? 0 : (pressure[leftIndices[i]] - thisPressure));
-				ShallowTest::Vector2 topFlow = top * (topIndices[i] == -1 ? 0 : (pressure[topIndices[i]] - thisPressure));
-				ShallowTest::Vector2 rightFlow = right * (rightIndices[i] == -1 ? 0 : (pressure[rightIndices[i]] - thisPressure));
-				ShallowTest::Vector2 bottomFlow = bottom * (bottomIndices[i] == -1 ? 0 : (pressure[bottomIndices[i]] - thisPressure));
-				ShallowTest::Vector2 pressureImpact = (leftFlow + topFlow  + rightFlow * 0.f + bottomFlow * 0.f);
-				pressureImpact.SafeNormalize();
-				ShallowTest::Vector2 randomImpact = ShallowTest::Vector2::RandomUnit();
-				ShallowTest::Vector2 backgroundImpact = left * leftMult + top * topMult + right * rightMult + bottom * bottomMult;
-				backgroundImpact.SafeNormalize();
-				flow[i] = backgroundImpact /* + randomImpact */+ pressureImpact * 3.5f;
+						ShallowTest::Vector2 leftFlow = left * (leftIndices[i] == -1 ? 0 : (pressure[leftIndices[i]] - thisPressure));
+						ShallowTest::Vector2 topFlow = top * (topIndices[i] == -1 ? 0 : (pressure[topIndices[i]] - thisPressure));
+						ShallowTest::Vector2 rightFlow = right * (rightIndices[i] == -1 ? 0 : (pressure[rightIndices[i]] - thisPressure));
+						ShallowTest::Vector2 bottomFlow = bottom * (bottomIndices[i] == -1 ? 0 : (pressure[bottomIndices[i]] - thisPressure));
+						const ShallowTest::Vector2 pressureImpact = VectorExpressions::fastNormalize(leftFlow + topFlow  + rightFlow * 0.f + bottomFlow * 0.f);
+						// ShallowTest::Vector2 randomImpact = ShallowTest::Vector2::RandomUnit();
+						const ShallowTest::Vector2 backgroundImpact = VectorExpressions::fastNormalize(left * leftMult + top * topMult + right * rightMult + bottom * bottomMult);
+						flow[i] = backgroundImpact /* + randomImpact */+ pressureImpact * 3.5f;
+					});
 			});
 	}
 };
 
 
-struct ArmyToProvinceAssignmentSystem
+/// Majority vote over the countries of the armies in one province. Counts go
+/// into a small open-addressing table on the stack, so the cost follows the
+/// armies present rather than the number of countries. Buckets with more
+/// distinct countries than the table holds are sorted instead.
+/// Ties go to the lowest country index.
+class CountryVote
 {
-	static tProvinceIndex GetProvinceIndexForPosition(const ShallowTest::Vector2 position)
+	static const int tableBits = 7;
+	static const int tableSize = 1 << tableBits;
+
+public:
+	struct Result
 	{
-		int x = (int)(position.x / Constants::provinceSize);
-		int y = (int)(position.y / Constants::provinceSize);
+		tCountryIndex countryIndex = -1;
+		int armyCount = 0;
+	};
 
-		return y * Constants::gridWidth + x;
-	}
+	static const int maxTallyCount = tableSize * 3 / 4;
 
-	static ShallowTest::Vector2 GetPositionFromProvinceIndex(tProvinceIndex index)
+	template<class CountryAt>
+	static Result Run(int armyCount, const CountryAt& countryAt)
 	{
-		int y = (index / Constants::gridWidth);
-		int x = (index - y * Constants::gridWidth);
+		Slot table[tableSize];
+		if (!fillTable(armyCount, countryAt, table))
+			return RunSorted(armyCount, countryAt);
 
-		return { (float)x * Constants::provinceSize, (float)y * Constants::provinceSize };
+		Result result;
+		for (const Slot& slot : table)
+		{
+			if (slot.countryIndex != -1 && (slot.armyCount > result.armyCount || (slot.armyCount == result.armyCount && slot.countryIndex < result.countryIndex)))
+				result = { slot.countryIndex, slot.armyCount };
+		}
+		return result;
 	}
 
-	static void AssignArmies(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces, 
-		std::vector<tArmyIndex>& armyIndices, std::vector<Army>& armies, std::vector<tArmyIndex>& armyAssignments, 
-		std::vector<std::vector<int>>& armiesPerProvincePerThread, std::vector<int>& armyToCountry)
+	/// Armies per country of one part of a province, for votes split over
+	/// threads. Writes at most maxTallyCount entries and returns their number,
+	/// or -1 when the part holds more distinct countries than that.
+	template<class CountryAt>
+	static int Tally(int armyCount, const CountryAt& countryAt, Result* output)
 	{
-		OPTICK_EVENT(__FUNCTION__);
+		Slot table[tableSize];
+		if (!fillTable(armyCount, countryAt, table))
+			return -1;
 
-		const size_t provinceCount = provinceIndices.size();
-		const int batchSize = 65535;
+		int count = 0;
+		for (const Slot& slot : table)
+		{
+			if (slot.countryIndex != -1)
+				output[count++] = { slot.countryIndex, slot.armyCount };
+		}
+		return count;
+	}
 
+	/// Majority over armies per country, indexed by country.
+	static Result FromCounts(const int* counts, int countryCount)
+	{
+		Result result;
+		for (int countryIndex = 0; countryIndex < countryCount; ++countryIndex)
 		{
-			OPTICK_EVENT("Count");
+			if (counts[countryIndex] > result.armyCount)
+				result = { countryIndex, counts[countryIndex] };
+		}
+		return result;
+	}
 
-			splitParallelFor(provinceIndices, 256, [&](auto& range, int batchIndex)
-				{
-					for (int i : range)
-					{
-						provinces[i].armyCount._a = 0;
-					}
-				});
+	/// Majority over the tallies of all parts of a province; reorders them.
+	static Result Merge(Result* tallies, int count)
+	{
+		std::sort(tallies, tallies + count, [](const Result& a, const Result& b) { return a.countryIndex < b.countryIndex; });
 
-			splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
-				{
-					for (int i : range)
-					{
-						armies[i].provinceIndex = GetProvinceIndexForPosition(armies[i].position);
-						++provinces[armies[i].provinceIndex].armyCount;
-					}
-				});
+		Result result;
+		for (int runBegin = 0; runBegin < count;)
+		{
+			Result total = { tallies[runBegin].countryIndex, 0 };
+			int runEnd = runBegin;
+			for (; runEnd < count && tallies[runEnd].countryIndex == total.countryIndex; ++runEnd)
+				total.armyCount += tallies[runEnd].armyCount;
+
+			if (total.armyCount > result.armyCount)
+				result = total;
+			runBegin = runEnd;
 		}
+		return result;
+	}
 
-		int totalCount = 0;
+private:
+	struct Slot
+	{
+		tCountryIndex countryIndex;
+		int armyCount;
+	};
+
+	// False when there are more than maxTallyCount distinct countries.
+	template<class CountryAt>
+	static bool fillTable(int armyCount, const CountryAt& countryAt, Slot (&table)[tableSize])
+	{
+		for (Slot& slot : table)
+			slot.countryIndex = -1;
+
+		int distinctCount = 0;
+		for (int i = 0; i < armyCount; ++i)
 		{
-			OPTICK_EVENT("Total");
-			serialFor(provinceIndices, [&](int i)
-				{
-					provinces[i].armyStartIndex = totalCount;
-					totalCount += provinces[i].armyCount._a;
-					provinces[i].armyCount._a = 0;
-				}
-			);
-		}
+			const tCountryIndex countryIndex = countryAt(i);
 
-		assert(totalCount == armyIndices.size());
-		armyAssignments.resize(totalCount);
+			unsigned int slotIndex = ((unsigned int)countryIndex * 0x9E3779B1u) >> (32 - tableBits);
+			while (table[slotIndex].countryIndex != countryIndex && table[slotIndex].countryIndex != -1)
+				slotIndex = (slotIndex + 1) & (tableSize - 1);
 
-#if defined(_DEBUG)
-		std::fill(armyAssignments.begin(), armyAssignments.end(), -1);
-#endif
+			if (table[slotIndex].countryIndex == -1)
+			{
+				if (++distinctCount > maxTallyCount)
+					return false;
 
+				table[slotIndex] = { countryIndex, 0 };
+			}
+
+			++table[slotIndex].armyCount;
+		}
+		return true;
+	}
+
+	template<class CountryAt>
+	static Result RunSorted(int armyCount, const CountryAt& countryAt)
+	{
+		// Grows to the largest contested bucket once per thread, then gets reused.
+		thread_local std::vector<tCountryIndex> sorted;
+		sorted.resize(armyCount);
+		for (int i = 0; i < armyCount; ++i)
+			sorted[i] = countryAt(i);
+		std::sort(sorted.begin(), sorted.end());
+
+		Result result;
+		for (int runBegin = 0; runBegin < armyCount;)
 		{
-			OPTICK_EVENT("Set");
+			int runEnd = runBegin + 1;
+			while (runEnd < armyCount && sorted[runEnd] == sorted[runBegin])
+				++runEnd;
 
-			int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
-			armiesPerProvincePerThread.resize(provinceIndices.size() * batchCount);
+			if (runEnd - runBegin > result.armyCount)
+				result = { sorted[runBegin], runEnd - runBegin };
+			runBegin = runEnd;
+		}
+		return result;
+	}
+};
 
-			std::vector<int> batchIndices;
-			batchIndices.resize(batchCount);
+/// Skew-aware schedule for per-province passes over the army buckets kept by
+/// ProvinceBuckets. Provinces are taken in order and batched until a task
+/// holds about armiesPerTask armies; a province holding more than that is
+/// split into parts of its bucket, so a hub with most of the armies is spread
+/// over all threads instead of landing on one.
+/// Built from the frame arena; lives at most one frame.
+class ProvinceTasks
+{
+public:
+	static const int armiesPerTask = 16384;
 
+	struct Task
+	{
+		// Range of provinceIndices.
+		int begin;
+		int end;
+		// Bucket range of a part of a split province; -1 for whole provinces.
+		int armyBegin = -1;
+		int armyEnd = -1;
+	};
+
+	ProvinceTasks(const std::vector<tProvinceIndex>& provinceIndices, const std::vector<Province>& provinces)
+		: provinceIndices(provinceIndices)
+		, tasks(FrameArena::Resource())
+	{
+		const int provinceCount = (int)provinceIndices.size();
+		int batchBegin = 0;
+		int batchArmies = 0;
+		for (int k = 0; k < provinceCount; ++k)
+		{
+			const Province& province = provinces[provinceIndices[k]];
+			const int armyCount = province.armyCount._a;
+			if (armyCount <= armiesPerTask)
 			{
-				OPTICK_EVENT("Armies");
-				splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
-					{
-						batchIndices[batchIndex] = batchIndex;
-						for (int i : range)
-						{
-							const int provinceIndex = armies[i].provinceIndex;
-							armiesPerProvincePerThread[provinceIndex * batchCount + batchIndex]
-								.reserve(std::max(256, (int)armiesPerProvincePerThread[provinceIndex * batchCount + batchIndex].size()));
-							armiesPerProvincePerThread[provinceIndex * batchCount + batchIndex].push_back(i);
-						}
-					});
+				// Every province costs a little, even an empty one.
+				batchArmies += armyCount + 1;
+				if (batchArmies >= armiesPerTask)
+				{
+					tasks.push_back({ batchBegin, k + 1 });
+					batchBegin = k + 1;
+					batchArmies = 0;
+				}
+				continue;
+			}
+
+			if (batchBegin < k)
+				tasks.push_back({ batchBegin, k });
+
+			const int partCount = (armyCount + armiesPerTask - 1) / armiesPerTask;
+			for (int part = 0; part < partCount; ++part)
+			{
+				const int armyBegin = province.armyStartIndex + (int)((long long)armyCount * part / partCount);
+				const int armyEnd = province.armyStartIndex + (int)((long long)armyCount * (part + 1) / partCount);
+				tasks.push_back({ k, k + 1, armyBegin, armyEnd });
 			}
+			batchBegin = k + 1;
+			batchArmies = 0;
+		}
+
+		if (batchBegin < provinceCount)
+			tasks.push_back({ batchBegin, provinceCount });
+	}
 
+	int GetTaskCount() const { return (int)tasks.size(); }
+
+	/// Calls wholeProvince(i) for every province of the batched tasks and
+	/// provincePart(i, armyBegin, armyEnd, taskIndex) for every part of a split
+	/// province, on the pool threads.
+	template<class WholeProvince, class ProvincePart>
+	void Run(const WholeProvince& wholeProvince, const ProvincePart& provincePart) const
+	{
+		ThreadPool::Get().Run(GetTaskCount(), [&](int taskIndex)
 			{
+				const Task& task = tasks[taskIndex];
+				if (task.armyBegin >= 0)
 				{
-					OPTICK_EVENT("InitA2C");
-					parallelFor(armyIndices, [&](int i)
-						{
-							armyToCountry[i] = armies[i].getCountryIndex();
-						});
+					provincePart(provinceIndices[task.begin], task.armyBegin, task.armyEnd, taskIndex);
+					return;
 				}
 
-				OPTICK_EVENT("Provinces");
-				parallelFor(provinceIndices, [&](int i)
-					{
-						const int armyStartIndex = provinces[i].armyStartIndex;
-						std::size_t count = 0;
-						{
-							OPTICK_EVENT("CountIndices");
-							for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
-							{
-								std::vector<int>& provinceArmyIndices = armiesPerProvincePerThread[i * batchCount + batchIndex];
-								std::copy(provinceArmyIndices.begin(), provinceArmyIndices.end(), armyAssignments.begin() + armyStartIndex + count);
-								count += provinceArmyIndices.size();
-							}
-						}
-						{
-							OPTICK_EVENT("AtomicCount");
-							provinces[i].armyCount._a = (int)count;
-						}
+				for (int k = task.begin; k < task.end; ++k)
+					wholeProvince(provinceIndices[k]);
+			});
+	}
 
-						std::vector<int> countryCounts;
-						countryCounts.resize(Constants::maxCountries);
+	/// Calls merge(i, firstTaskIndex, partCount) for every split province, on the calling thread.
+	template<class Merge>
+	void ForEachSplit(const Merge& merge) const
+	{
+		for (int taskIndex = 0; taskIndex < GetTaskCount();)
+		{
+			if (tasks[taskIndex].armyBegin < 0)
+			{
+				++taskIndex;
+				continue;
+			}
 
-						{
-							OPTICK_EVENT("CountArmies");
-							for (int armyIndex = 0; armyIndex < count; ++armyIndex)
-							{
-								++countryCounts[armyToCountry[armyAssignments[armyStartIndex + armyIndex]]];
-							}
-						}
+			int partCount = 1;
+			while (taskIndex + partCount < GetTaskCount() && tasks[taskIndex + partCount].armyBegin >= 0 && tasks[taskIndex + partCount].begin == tasks[taskIndex].begin)
+				++partCount;
 
-						int bestCount = 0;
-						int bestIndex = -1;
-						for (int countryIndex = 0; countryIndex < Constants::maxCountries; ++countryIndex)
-						{
-							if (countryCounts[countryIndex] > bestCount)
-							{
-								bestCount = countryCounts[countryIndex];
-								bestIndex = countryIndex;
-							}
-						}
+			merge(provinceIndices[tasks[taskIndex].begin], taskIndex, partCount);
+			taskIndex += partCount;
+		}
+	}
 
-						if (bestIndex >= 0)
-						{
-							provinces[i].prevCountryIndex = provinces[i].countryIndex;
-							provinces[i].countryIndex = bestIndex;
-						}
-					});
+private:
+	const std::vector<tProvinceIndex>& provinceIndices;
+	std::pmr::vector<Task> tasks;
+};
+
+struct ArmyToProvinceAssignmentSystem
+{
+	static tProvinceIndex GetProvinceIndexForPosition(const ShallowTest::Vector2 position)
+	{
+		return GridGeometry::Get().GetProvinceIndexForPosition(position);
+	}
+
+	static ShallowTest::Vector2 GetPositionFromProvinceIndex(tProvinceIndex index)
+	{
+		return GridGeometry::Get().GetPositionFromProvinceIndex(index);
+	}
+
+	/// Armies bucketed into the province, see ProvinceBuckets::GetArmies.
+	static Range<std::vector<tArmyIndex>::const_iterator> GetProvinceArmies(const Province& province, const std::vector<tArmyIndex>& armyAssignments)
+	{
+		const auto begin = armyAssignments.cbegin() + province.armyStartIndex;
+		return makeConstRange<tArmyIndex>(begin, begin + province.armyCount._a.load());
+	}
+
+	/// Moves the armies that crossed a province border during the last
+	/// movement into their new provinces and buckets, before kills and spawns reuse their indices.
+	static void ApplyCrossings(const std::vector<tProvinceIndex>& provinceIndices, const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies, ProvinceBuckets& buckets)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmyToProvinceAssignmentSystem::ApplyCrossings");
+
+		buckets.ApplyCrossings(provinceIndices, armies, (int)armyIndices.size());
+	}
+
+	/// Publishes the province buckets, rebuilding them when due, and runs the
+	/// ownership vote. With country counts only provinces whose armies changed
+	/// vote again; the others keep their last majority.
+	static void AssignArmies(const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces,
+		std::vector<tArmyIndex>& armyIndices, ArmyVector& armies, ProvinceBuckets& buckets)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmyToProvinceAssignmentSystem::AssignArmies");
+
+		buckets.Update(provinceIndices, provinces, armyIndices, armies);
+
+		OPTICK_EVENT("Provinces");
+		auto applyVote = [&](int i, const CountryVote::Result& vote)
+		{
+			provinces[i].majorityCountryIndex = (short)vote.countryIndex;
+			provinces[i].majorityArmyCount = vote.armyCount;
+
+			if (vote.countryIndex >= 0)
+			{
+				provinces[i].prevCountryIndex = provinces[i].countryIndex;
+				provinces[i].countryIndex = (short)vote.countryIndex;
 			}
+		};
+
+		if (buckets.HasCountryCounts())
+		{
+			parallelFor(provinceIndices, [&](int i)
+				{
+					if (buckets.TakeChanged(i))
+						applyVote(i, CountryVote::FromCounts(buckets.GetCountryCounts(i), buckets.GetCountryCount()));
+					else
+						applyVote(i, { provinces[i].majorityCountryIndex, provinces[i].majorityArmyCount });
+				});
+			return;
 		}
+
+		const std::vector<tArmyIndex>& armyAssignments = buckets.GetArmies();
+		auto countryAt = [&](int bucketBegin)
+		{
+			return [&, bucketBegin](int armyIndex) { return armies[armyAssignments[bucketBegin + armyIndex]].getCountryIndex(); };
+		};
+
+		// Parts of split provinces tally into fixed slots, merged into one vote afterwards.
+		const ProvinceTasks tasks(provinceIndices, provinces);
+		std::pmr::vector<CountryVote::Result> tallies((size_t)tasks.GetTaskCount() * CountryVote::maxTallyCount, FrameArena::Resource());
+		std::pmr::vector<int> tallyCounts(tasks.GetTaskCount(), 0, FrameArena::Resource());
+
+		tasks.Run(
+			[&](int i)
+			{
+				applyVote(i, CountryVote::Run(provinces[i].armyCount._a, countryAt(provinces[i].armyStartIndex)));
+			},
+			[&](int, int armyBegin, int armyEnd, int taskIndex)
+			{
+				tallyCounts[taskIndex] = CountryVote::Tally(armyEnd - armyBegin, countryAt(armyBegin), tallies.data() + (size_t)taskIndex * CountryVote::maxTallyCount);
+			});
+
+		tasks.ForEachSplit([&](int i, int firstTaskIndex, int partCount)
+			{
+				std::pmr::vector<CountryVote::Result> merged(FrameArena::Resource());
+				for (int taskIndex = firstTaskIndex; taskIndex < firstTaskIndex + partCount; ++taskIndex)
+				{
+					// A part with too many distinct countries falls back to one vote over the whole bucket.
+					if (tallyCounts[taskIndex] < 0)
+					{
+						applyVote(i, CountryVote::Run(provinces[i].armyCount._a, countryAt(provinces[i].armyStartIndex)));
+						return;
+					}
+
+					const CountryVote::Result* tally = tallies.data() + (size_t)taskIndex * CountryVote::maxTallyCount;
+					merged.insert(merged.end(), tally, tally + tallyCounts[taskIndex]);
+				}
+				applyVote(i, CountryVote::Merge(merged.data(), (int)merged.size()));
+			});
 	}
 };
 
@@ -308,6 +543,7 @@ struct ProvinceToCountryAssignmentSystem
 	static void AssignProvinces(const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, const std::vector<tProvinceIndex>& provinceIndices, std::vector<Province>& provinces, std::vector<tProvinceIndex>& provinceAssignments)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ProvinceToCountryAssignmentSystem::AssignProvinces");
 		parallelFor(countryIndices, [&](int i)
 			{
 				countries[i].provinceCount = 0;
@@ -355,16 +591,15 @@ struct ProvinceToCountryAssignmentSystem
 class ArmyToCountryAssignmentSystem
 {
 public:
-	static void AssignArmies(const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, std::vector<tArmyIndex>& armyIndices, std::vector<Army>& armies)
+	static void AssignArmies(const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, std::vector<tArmyIndex>& armyIndices, ArmyVector& armies)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmyToCountryAssignmentSystem::AssignArmies");
 
 		int batchCount = splitParallelForGetBatchCount(armyIndices, 65535);
+		const int countryCount = (int)countries.size();
 
-		std::vector<int> armyCounts;
-		armyCounts.resize(batchCount * Constants::maxCountries, 0);
-		const int armyCount = (int)armyIndices.size();
-
+		std::pmr::vector<int> armyCounts(batchCount * countryCount, 0, FrameArena::Resource());
 		for (int i : countryIndices)
 		{
 			countries[i].armyCount._a = 0;
@@ -374,14 +609,14 @@ public:
 			{
 				for (int i : range)
 				{
-					++armyCounts[batchIndex * Constants::maxCountries + armies[i].getCountryIndex()];
+					++armyCounts[batchIndex * countryCount + armies[i].getCountryIndex()];
 				}
 			});
 
 
-		for (int i = 0; i < armyCounts.size(); ++i)
+		for (int i = 0; i < (int)armyCounts.size(); ++i)
 		{
-			countries[i % Constants::maxCountries].armyCount._a += armyCounts[i];
+			countries[i % countryCount].armyCount._a += armyCounts[i];
 		}
 	}
 };
@@ -389,7 +624,7 @@ public:
 class CountrySystem
 {
 public:
-	static void CalcPositionFromFlow(const std::vector<tCountryIndex>& indices, std::vector<Country>& countries, const std::vector<ShallowTest::Vector2>& flow, const std::vector<ShallowTest::Vector2>& randomVectors, float delta)
+	static void CalcPositionFromFlow(const std::vector<tCountryIndex>& indices, std::vector<Country>& countries, const std::vector<ShallowTest::Vector2>& flow, const ArmyVectorField& randomVectors, float delta)
 	{
 		parallelFor(indices, [&](int i)
 			{
@@ -404,25 +639,218 @@ public:
 	}
 };
 
-class ArmySystem
+/// Keeps armies from piling onto the same pixel, using a fine uniform grid
+/// rebuilt every tick.
+class SeparationSystem
 {
 public:
-	static void CalcPositionFromFlow(const std::vector<int>& indices, std::vector<Army>& armies, const std::vector<ShallowTest::Vector2>& flow, const std::vector<ShallowTest::Vector2>& randomVectors, float delta)
+	static const int cellSize = 8;
+	static const int cellsX = (Constants::screenWidth + cellSize - 1) / cellSize;
+	static const int cellsY = (Constants::screenHeight + cellSize - 1) / cellSize;
+	static const int cellCount = cellsX * cellsY;
+
+	// Armies either side of an army's slot in its own cell that it is pushed away from.
+	static constexpr int sameCellNeighbours = 4;
+
+	static int GetCellIndexForPosition(const ShallowTest::Vector2& position)
+	{
+		const int x = std::min((int)position.x / cellSize, cellsX - 1);
+		const int y = std::min((int)position.y / cellSize, cellsY - 1);
+		return y * cellsX + x;
+	}
+
+	/// Counting sort of the armies by cell, parallel the same way as
+	/// ProvinceBuckets::Update. Cell c holds
+	/// cellArmies[cellStart[c], cellStart[c + 1]), and cellPositions holds their
+	/// positions in the same order, so the neighbour search reads contiguous memory.
+	static void BuildGrid(const std::vector<int>& cellIndices, const std::vector<tArmyIndex>& armyIndices, const ArmyVector& armies,
+		std::vector<int>& cellStart, std::vector<tArmyIndex>& cellArmies, ArmyVectorField& cellPositions)
 	{
 		OPTICK_EVENT(__FUNCTION__);
-		parallelFor(indices, [&](int i)
+		SYSTEM_SCOPE("SeparationSystem::BuildGrid");
+
+		const int batchSize = 65535;
+		const int batchCount = splitParallelForGetBatchCount(armyIndices, batchSize);
+		std::pmr::vector<int> batchOffsets(cellCount * batchCount, 0, FrameArena::Resource());
+
+		splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+			{
+				int* counts = batchOffsets.data() + batchIndex * cellCount;
+				for (int i : range)
+				{
+					++counts[GetCellIndexForPosition(armies[i].getPosition())];
+				}
+			});
+
+		cellStart.resize(cellCount + 1);
+		int totalCount = 0;
+		serialFor(cellIndices, [&](int i)
 			{
-				ShallowTest::Vector2 velocity = (flow[armies[i].provinceIndex] * 0.7f + randomVectors[i] * 0.5f);
-				armies[i].position = armies[i].position + velocity * delta * Constants::armySpeed;
-				armies[i].position.x = std::clamp<float>(armies[i].position.x, 0, Constants::screenWidth - 1);
-				armies[i].position.y = std::clamp<float>(armies[i].position.y, 0, Constants::screenHeight - 1);
+				cellStart[i] = totalCount;
+				for (int batchIndex = 0; batchIndex < batchCount; ++batchIndex)
+				{
+					int& batchOffset = batchOffsets[batchIndex * cellCount + i];
+					const int count = batchOffset;
+					batchOffset = totalCount;
+					totalCount += count;
+				}
+			});
+		cellStart[cellCount] = totalCount;
+
+		assert(totalCount == (int)armyIndices.size());
+		cellArmies.resize(totalCount);
+		cellPositions.resize(totalCount);
+
+		splitParallelFor(armyIndices, batchSize, [&](auto& range, int batchIndex)
+			{
+				int* offsets = batchOffsets.data() + batchIndex * cellCount;
+				for (int i : range)
+				{
+					const ShallowTest::Vector2 position = armies[i].getPosition();
+					const int slot = offsets[GetCellIndexForPosition(position)]++;
+					cellArmies[slot] = i;
+					cellPositions[slot] = position;
+				}
+			});
+	}
+
+	/// Writes a repulsion direction of at most unit length for every bucketed army.
+	/// Each army is pushed away from a few armies around its slot in its own cell,
+	/// and down the density gradient towards emptier adjacent cells, so the cost per
+	/// army stays flat however dense a hub gets. Armies on exactly the same spot are
+	/// pushed along their random vector.
+	static void CalcForces(const std::vector<int>& cellIndices, const std::vector<int>& cellStart, const std::vector<tArmyIndex>& cellArmies,
+		const ArmyVectorField& cellPositions, const ArmyVectorField& randomVectors, ArmyVectorField& output)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("SeparationSystem::CalcForces");
+
+		std::pmr::vector<ShallowTest::Vector2> cellGradient(cellCount, FrameArena::Resource());
+		{
+			OPTICK_EVENT("Gradient");
+			parallelFor(cellIndices, [&](int cell)
+				{
+					const int count = cellStart[cell + 1] - cellStart[cell];
+					const int cellX = cell % cellsX;
+					const int cellY = cell / cellsX;
+
+					// Cells past the screen edge count as equally full, so nothing is pushed off screen.
+					ShallowTest::Vector2 gradient(0.0f, 0.0f);
+					for (int y = std::max(cellY - 1, 0); y <= std::min(cellY + 1, cellsY - 1); ++y)
+					{
+						for (int x = std::max(cellX - 1, 0); x <= std::min(cellX + 1, cellsX - 1); ++x)
+						{
+							const int neighbourCell = y * cellsX + x;
+							const int neighbourCount = cellStart[neighbourCell + 1] - cellStart[neighbourCell];
+							const float pressure = (float)(count - neighbourCount) / (float)(count + neighbourCount + 1);
+							gradient = gradient + ShallowTest::Vector2((float)(x - cellX), (float)(y - cellY)) * pressure;
+						}
+					}
+					cellGradient[cell] = gradient * 0.25f;
+				});
+		}
+
+		const float radius = (float)cellSize;
+		const float inverseRadius = 1.0f / radius;
+		parallelFor(cellIndices, [&](int cell)
+			{
+				const int begin = cellStart[cell];
+				const int count = cellStart[cell + 1] - begin;
+				const int sameCell = std::min(sameCellNeighbours, count - 1);
+
+				for (int slot = 0; slot < count; ++slot)
+				{
+					const tArmyIndex i = cellArmies[begin + slot];
+					const ShallowTest::Vector2 position = cellPositions[begin + slot];
+					ShallowTest::Vector2 force = cellGradient[cell];
+
+					// Alternates between the slots after and before this one, wrapping around the cell.
+					for (int n = 1; n <= sameCell; ++n)
+					{
+						const int step = (n + 1) / 2;
+						int neighbourSlot = n % 2 ? slot + step : slot - step;
+						if (neighbourSlot >= count)
+							neighbourSlot -= count;
+						else if (neighbourSlot < 0)
+							neighbourSlot += count;
+
+						const ShallowTest::Vector2 offset = position - cellPositions[begin + neighbourSlot];
+						const float distanceSquared = offset.x * offset.x + offset.y * offset.y;
+						if (distanceSquared >= radius * radius)
+							continue;
+
+						if (distanceSquared < 1e-6f)
+							force = force + randomVectors[i];
+						else // (radius - distance) / (radius * distance)
+							force = force + offset * (VectorExpressions::reciprocalSqrt(distanceSquared) - inverseRadius);
+					}
+
+					const float lengthSquared = force.x * force.x + force.y * force.y;
+					if (lengthSquared > 1.0f)
+						force = force * VectorExpressions::reciprocalSqrt(lengthSquared);
+					output[i] = force;
+				}
+			});
+	}
+};
 
-				assert(armies[i].position.x >= 0.0f);
-				assert(armies[i].position.y >= 0.0f);
+class ArmySystem
+{
+public:
+	/// Separation, from SeparationSystem, and the army's country direction, from
+	/// NavigationFields, are blended in unless they are empty.
+	/// With stride above 1 only armies with index % stride == phase move, by stride times
+	/// the delta, so every army covers the same distance over stride ticks.
+	/// Armies leaving their province are recorded as crossings in buckets and keep
+	/// their province index until ArmyToProvinceAssignmentSystem::ApplyCrossings, so
+	/// the rest of the tick sees the provinces the buckets hold.
+	static void CalcPositionFromFlow(const std::vector<int>& indices, ArmyVector& armies, const std::vector<ShallowTest::Vector2>& flow, const ArmyVectorField& randomVectors,
+		const ArmyVectorField& separation, const std::vector<NavigationDirection>& navigation, ProvinceBuckets& buckets, float delta, int stride = 1, int phase = 0)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmySystem::CalcPositionFromFlow");
+		const float stepDelta = delta * stride;
+		const float separationWeight = 0.6f;
+		const float navigationWeight = 0.6f;
+		const size_t provinceCount = flow.size();
+		const int batchSize = 65535;
+		buckets.BeginCrossings(splitParallelForGetBatchCount(indices, batchSize));
+
+		dispatchGrid(GridGeometry::Get(), [&](const auto& grid)
+			{
+				splitParallelFor(indices, batchSize, [&](auto& range, int batchIndex)
+					{
+						for (int i : range)
+						{
+							if (stride > 1 && i % stride != phase)
+								continue;
+
+							const tProvinceIndex provinceIndex = armies[i].getProvinceIndex();
+							ShallowTest::Vector2 velocity = (flow[provinceIndex] * 0.7f + randomVectors[i] * 0.5f);
+							if (!navigation.empty())
+								velocity = velocity + navigation[armies[i].getCountryIndex() * provinceCount + provinceIndex].ToVector() * navigationWeight;
+							if (!separation.empty())
+								velocity = velocity + separation[i] * separationWeight;
+							ShallowTest::Vector2 position = armies[i].getPosition() + velocity * stepDelta * Constants::armySpeed;
+							position.x = std::clamp<float>(position.x, 0, Constants::screenWidth - 1);
+							position.y = std::clamp<float>(position.y, 0, Constants::screenHeight - 1);
+							armies[i].setPosition(position);
+
+							assert(position.x >= 0.0f);
+							assert(position.y >= 0.0f);
+
+							// The stored position may be rounded, and that is the one bucketed.
+							const tProvinceIndex newProvinceIndex = grid.GetProvinceIndexForPosition(armies[i].getPosition());
+							if (newProvinceIndex != provinceIndex)
+							{
+								buckets.AddCrossing(batchIndex, { i, provinceIndex, newProvinceIndex, armies[i].getCountryIndex() });
+							}
+						}
+					});
 			});
 	}
 
-	static void SetValid(const std::vector<int>& indices, bool valid, std::vector<Army>& output)
+	static void SetValid(const std::vector<int>& indices, bool /*valid*/, ArmyVector& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -432,7 +860,7 @@ public:
 
 	}
 
-	static void SetHitPoints(const std::vector<int>& indices, char hitPoints, std::vector<Army>& output)
+	static void SetHitPoints(const std::vector<int>& indices, char hitPoints, ArmyVector& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -441,7 +869,7 @@ public:
 			});
 	}
 
-	static void SetCountryIndex(const std::vector<int>& indices, int countryIndex, std::vector<Army>& output)
+	static void SetCountryIndex(const std::vector<int>& indices, int countryIndex, ArmyVector& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -451,7 +879,7 @@ public:
 
 	}
 
-	static void GetSpeed(const std::vector<int>& indices, const std::vector<Army>& input, std::vector<float>& output)
+	static void GetSpeed(const std::vector<int>& indices, const ArmyVector& /*input*/, std::vector<float>& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
@@ -460,18 +888,22 @@ public:
 			});
 	}
 
-	static void SetPosition(const std::vector<int>& indices, const std::vector<ShallowTest::Vector2>& input, std::vector<Army>& output)
+	static void SetPosition(const std::vector<int>& indices, const ArmyVectorField& input, ArmyVector& output)
 	{
 		OPTICK_EVENT(__FUNCTION__);
 		parallelFor(indices, [&](int i)
 			{
-				output[i].position = input[i];
+				output[i].setPosition(input[i]);
 			});
 	}
 
-	static void MergeKilledAndSpawned(const std::vector<int>& armyIndicesAll, std::vector<int>& armyIndices, std::vector<Army>& armies, const std::vector<Country>& countries, std::vector<int>& killedArmies, std::vector<tCountryIndex>& spawnedArmies)
+	/// Reuses killed army slots for spawns, then fills the remaining holes with the last
+	/// live armies. buckets follow every army that is removed, moved or spawned.
+	static void MergeKilledAndSpawned(const std::vector<int>& /*armyIndicesAll*/, std::vector<int>& armyIndices, ArmyVector& armies, ArmyPool& armyPool, const std::vector<Country>& countries,
+		ProvinceBuckets& buckets, std::vector<int>& killedArmies, std::vector<tCountryIndex>& spawnedArmies)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmySystem::MergeKilledAndSpawned");
 		const int spawnCount = (int)spawnedArmies.size();
 		const int killedCount = (int)killedArmies.size();
 
@@ -480,12 +912,17 @@ public:
 
 		auto reuseArmy = [&](tArmyIndex armyIndex, tCountryIndex countryIndex)
 		{
+			buckets.Remove(armyIndex, armies);
+
 			Army& armyToSpawn = armies[armyIndex];
 			armyToSpawn.validate();
 			armyToSpawn.setCountryIndex(countryIndex);
 			armyToSpawn.setHitPoints(Constants::armyInitialHitPoints);
-			armyToSpawn.position = countries[countryIndex].position;
-			armyToSpawn.provinceIndex = -1;
+			armyToSpawn.setPosition(countries[countryIndex].position);
+			buckets.Insert(armyIndex, armies);
+
+			armyPool.Destroy(armyPool.GetHandle(armyIndex));
+			armyPool.Create(armyIndex);
 		};
 
 		for (int i = 0; i < spawnCount; ++i)
@@ -506,19 +943,24 @@ public:
 			}
 		}
 
-		int shrinkCounter = 0;
+		const int shrinkCounter = killedCount - killedConsumed;
 
-		// Remove killed armies
-		for (int i = killedConsumed; i < killedCount; ++i)
+		// Remove killed armies. Killed indices are ascending, so walking them backwards
+		// guarantees the last live army is never one that is about to be removed.
+		tArmyIndex liveArmyIndex = (int)armyIndices.size() - 1;
+		for (int i = killedCount - 1; i >= killedConsumed; --i)
 		{
 			const tArmyIndex killedArmyIndex = (int)killedArmies[i];
-			const tArmyIndex liveArmyIndex = (int)armyIndices.size() - 1 - (i - killedConsumed);
+			armyPool.Destroy(armyPool.GetHandle(killedArmyIndex));
+			buckets.Remove(killedArmyIndex, armies);
 
 			if (killedArmyIndex < liveArmyIndex)
 			{
 				std::swap(armies[killedArmyIndex], armies[liveArmyIndex]);
-				++shrinkCounter;
+				armyPool.Swap(killedArmyIndex, liveArmyIndex);
+				buckets.Relocate(liveArmyIndex, killedArmyIndex);
 			}
+			--liveArmyIndex;
 		}
 
 		if (overTheLimitIndex > 0)
@@ -537,9 +979,10 @@ public:
 		spawnedArmies.clear();
 	}
 
-	static void InitializeIndices(const std::vector<int>& armyIndicesAll, std::vector<int>& armyIndices, std::vector<Army>& armies)
+	static void InitializeIndices(const std::vector<int>& /*armyIndicesAll*/, std::vector<int>& armyIndices, ArmyVector& /*armies*/)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("ArmySystem::InitializeIndices");
 
 		std::iota(armyIndices.begin(), armyIndices.end(), 0);
 	}
@@ -551,15 +994,17 @@ public:
 	static void UpdateFactor(const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, float deltaT)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("SpawnSystem::UpdateFactor");
 		parallelFor(countryIndices, [&](int i)
 			{
 				countries[i].spawnFactor += deltaT * ((float)(std::max((short)1, countries[i].provinceCount)) * (float)Constants::spawnPerProvincePerSecond + (float)Constants::constantSpawnRate);
 			});
 	}
 
-	static void Spawn(std::vector<tArmyIndex>& armyIndices, std::vector<Army>&armies, const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, float deltaT, std::vector<tCountryIndex>& spawnedArmiesCountByCountry)
+	static void Spawn(std::vector<tArmyIndex>& armyIndices, ArmyVector& /*armies*/, const std::vector<tCountryIndex>& countryIndices, std::vector<Country>& countries, float /*deltaT*/, std::vector<tCountryIndex>& spawnedArmiesCountByCountry)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("SpawnSystem::Spawn");
 		const int countryCount = (int)countries.size();
 		std::atomic<int> totalToSpawn = 0;
 		serialFor(countryIndices, [&](int i)
@@ -589,37 +1034,88 @@ public:
 class CombatSystem
 {
 public:
-	static void DamageArmies(const std::vector<tArmyIndex>& armyIndices, std::vector<Army>& armies, const std::vector<Province>& provinces)
+	static void DamageArmies(const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies, const std::vector<Province>& provinces)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("CombatSystem::DamageArmies");
 		parallelFor(armyIndices, [&](int i)
 			{
-				if (provinces[armies[i].provinceIndex].countryIndex >= 0 && armies[i].getCountryIndex() != provinces[armies[i].provinceIndex].countryIndex)
+				const tProvinceIndex provinceIndex = armies[i].getProvinceIndex();
+				if (provinces[provinceIndex].countryIndex >= 0 && armies[i].getCountryIndex() != provinces[provinceIndex].countryIndex)
 					armies[i].setHitPoints(armies[i].getHitPoints() - 1);
 
-				if (provinces[armies[i].provinceIndex].countryIndex != provinces[armies[i].provinceIndex].prevCountryIndex 
-					&& provinces[armies[i].provinceIndex].prevCountryIndex == armies[i].getCountryIndex())
+				if (provinces[provinceIndex].countryIndex != provinces[provinceIndex].prevCountryIndex 
+					&& provinces[provinceIndex].prevCountryIndex == armies[i].getCountryIndex())
 					armies[i].setHitPoints(armies[i].getHitPoints() - 1);
 
 			});
 	}
 
-	static void DamageArmiesWithinRadius(const std::vector<tArmyIndex>& armyIndices, std::vector<Army>& armies, ShallowTest::Vector2 point, float radius)
+	/// Same rules as DamageArmies, walked province by province over the buckets kept by
+	/// ProvinceBuckets. Province state is loaded once per
+	/// province, and provinces where no army can take damage are skipped entirely.
+	static void DamageArmiesByProvince(const std::vector<tProvinceIndex>& provinceIndices, const std::vector<Province>& provinces, const std::vector<tArmyIndex>& armyAssignments, ArmyVector& armies)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("CombatSystem::DamageArmiesByProvince");
+		// Crowded provinces are split over threads, see ProvinceTasks.
+		auto damage = [&](int i, int armyBegin, int armyEnd)
+		{
+			const Province& province = provinces[i];
+			const int armyCount = province.armyCount._a;
+			const int owner = province.countryIndex;
+			const int prevOwner = province.prevCountryIndex;
+			const bool ownerChanged = owner != prevOwner;
+
+			if (armyCount == 0)
+				return;
+
+			if (!ownerChanged && (owner < 0 || (province.majorityCountryIndex == owner && province.majorityArmyCount == armyCount)))
+				return;
+
+			for (int slot = armyBegin; slot < armyEnd; ++slot)
+			{
+				Army& army = armies[armyAssignments[slot]];
+				const int countryIndex = army.getCountryIndex();
+
+				if (owner >= 0 && countryIndex != owner)
+					army.setHitPoints(army.getHitPoints() - 1);
+
+				if (ownerChanged && prevOwner == countryIndex)
+					army.setHitPoints(army.getHitPoints() - 1);
+			}
+		};
+
+		const ProvinceTasks tasks(provinceIndices, provinces);
+		tasks.Run(
+			[&](int i)
+			{
+				damage(i, provinces[i].armyStartIndex, provinces[i].armyStartIndex + provinces[i].armyCount._a);
+			},
+			[&](int i, int armyBegin, int armyEnd, int)
+			{
+				damage(i, armyBegin, armyEnd);
+			});
+	}
+
+	static void DamageArmiesWithinRadius(const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies, ShallowTest::Vector2 point, float radius)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("CombatSystem::DamageArmiesWithinRadius");
 		parallelFor(armyIndices, [&](int i)
 			{
 				Army& army = armies[i];
-				if ((point - army.position).Length() < radius)
+				if ((point - army.getPosition()).Length() < radius)
 				{
 					army.setHitPoints(0);
 				}
 			});
 	}
 
-	static void KillArmies(const std::vector<tArmyIndex>& armyIndices, std::vector<Army>& armies, std::vector<int>& indicesToKill)
+	static void KillArmies(const std::vector<tArmyIndex>& armyIndices, ArmyVector& armies, std::vector<int>& indicesToKill)
 	{
 		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("CombatSystem::KillArmies");
 		const int armyCount = (int)armyIndices.size();
 		for (int i = 0; i < armyCount; ++i)
 		{
@@ -632,24 +1128,87 @@ public:
 	}
 };
 
-class PeriodicTask
+/// Publishes what happened during a tick to the EventStream. Every system is a
+/// no-op while the stream is disabled.
+struct EventSystem
 {
-public:
-	PeriodicTask(std::function<void()> fn, float interval)
-		: _fn(fn), _interval(interval), _progress(0.0f)
-	{}
-	void update(float deltaT)
+	/// Compares owners against the last published ones rather than prevCountryIndex,
+	/// which stays stale on provinces no army voted in.
+	static void PublishOwnershipChanges(unsigned int tick, const std::vector<tProvinceIndex>& provinceIndices, const std::vector<Province>& provinces, std::vector<short>& publishedOwners)
 	{
 		OPTICK_EVENT(__FUNCTION__);
-		_progress += deltaT;
-		if (_progress > _interval)
+		SYSTEM_SCOPE("EventSystem::PublishOwnershipChanges");
+		if (!EventStream::IsEnabled())
+			return;
+
+		publishedOwners.resize(provinces.size(), -1);
+		splitParallelFor(provinceIndices, 4096, [&](auto& range, int)
+			{
+				EventBatch events;
+				for (int i : range)
+				{
+					const short owner = provinces[i].countryIndex;
+					if (owner == publishedOwners[i])
+						continue;
+
+					events.Add({ tick, SimulationEventType::ProvinceOwnerChanged, owner, i, publishedOwners[i] });
+					publishedOwners[i] = owner;
+				}
+			});
+	}
+
+	static void PublishKills(unsigned int tick, const std::vector<tArmyIndex>& killedArmies, const ArmyVector& armies, int countryCount)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("EventSystem::PublishKills");
+		if (!EventStream::IsEnabled() || killedArmies.empty())
+			return;
+
+		std::pmr::vector<int> killsPerCountry(countryCount, 0, FrameArena::Resource());
+		for (tArmyIndex armyIndex : killedArmies)
+			++killsPerCountry[armies[armyIndex].getCountryIndex()];
+
+		EventBatch events;
+		for (int countryIndex = 0; countryIndex < countryCount; ++countryIndex)
 		{
-			_progress -= _interval;
-			_fn();
+			if (killsPerCountry[countryIndex] > 0)
+				events.Add({ tick, SimulationEventType::ArmiesKilled, (short)countryIndex, killsPerCountry[countryIndex], 0 });
 		}
 	}
-private:
-	std::function<void()> _fn;
-	const float _interval;
-	float _progress;
+
+	/// Spawns are listed country by country, so every run of equal indices is one event.
+	static void PublishSpawns(unsigned int tick, const std::vector<tCountryIndex>& spawnedArmies)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("EventSystem::PublishSpawns");
+		if (!EventStream::IsEnabled())
+			return;
+
+		EventBatch events;
+		const int spawnCount = (int)spawnedArmies.size();
+		for (int runBegin = 0; runBegin < spawnCount;)
+		{
+			int runEnd = runBegin + 1;
+			while (runEnd < spawnCount && spawnedArmies[runEnd] == spawnedArmies[runBegin])
+				++runEnd;
+
+			events.Add({ tick, SimulationEventType::ArmiesSpawned, (short)spawnedArmies[runBegin], runEnd - runBegin, 0 });
+			runBegin = runEnd;
+		}
+	}
+
+	static void PublishCountryTotals(unsigned int tick, const std::vector<tCountryIndex>& countryIndices, const std::vector<Country>& countries)
+	{
+		OPTICK_EVENT(__FUNCTION__);
+		SYSTEM_SCOPE("EventSystem::PublishCountryTotals");
+		if (!EventStream::IsEnabled() || !EventStream::IsTotalsTick(tick))
+			return;
+
+		splitParallelFor(countryIndices, EventChunk::capacity, [&](auto& range, int)
+			{
+				EventBatch events;
+				for (int i : range)
+					events.Add({ tick, SimulationEventType::CountryTotals, (short)i, countries[i].armyCount._a.load(), countries[i].provinceCount });
+			});
+	}
 };
\ No newline at end of file
@@ -0,0 +1,76 @@
+#include <cstdio>
+
+#include "game_state.h"
+
+
+namespace
+{
+	int failureCount = 0;
+
+	void check(bool condition, const char* layout, const char* what)
+	{
+		if (condition)
+			return;
+		std::fprintf(stderr, "FAILED: %s: %s\n", layout, what);
+		++failureCount;
+	}
+
+	template<class A>
+	A makeArmy(int hitPoints)
+	{
+		A army;
+		army.setCountryIndex(A::maxCountryCount - 1);
+		army.setHitPoints(hitPoints);
+		return army;
+	}
+
+	// getHitPoints returns a char, which the 8 bit range of FloatArmy overflows.
+	template<class A>
+	int hitPointsOf(const A& army)
+	{
+		return (unsigned char)army.getHitPoints();
+	}
+
+	// Both layouts must simulate alike, so they run the same checks.
+	template<class A>
+	void checkLayout(const char* layout)
+	{
+		// Damage is applied as setHitPoints(getHitPoints() - 1), possibly twice in one tick.
+		{
+			A army = makeArmy<A>(1);
+			army.setHitPoints(army.getHitPoints() - 1);
+			check(hitPointsOf(army) == 0, layout, "one decrement from 1 reaches 0");
+			army.setHitPoints(army.getHitPoints() - 1);
+			check(hitPointsOf(army) == 0, layout, "a decrement below 0 saturates at 0");
+			army.setHitPoints(army.getHitPoints() - 1);
+			check(hitPointsOf(army) == 0, layout, "repeated decrements stay at 0");
+		}
+
+		{
+			A army = makeArmy<A>(0);
+			army.setHitPoints(-200);
+			check(hitPointsOf(army) == 0, layout, "large negative values clamp to 0");
+			army.setHitPoints(A::maxHitPoints + 1);
+			check(hitPointsOf(army) == A::maxHitPoints, layout, "values past the range clamp to maxHitPoints");
+			army.setHitPoints(Constants::armyInitialHitPoints);
+			check(hitPointsOf(army) == Constants::armyInitialHitPoints, layout, "initial hit points round trip");
+		}
+
+		// Hit points share a field with the country index, which must survive clamping.
+		{
+			A army = makeArmy<A>(1);
+			army.setHitPoints(-1);
+			check(army.getCountryIndex() == A::maxCountryCount - 1, layout, "clamping keeps the country index");
+		}
+	}
+}
+
+int main()
+{
+	checkLayout<FloatArmy>("FloatArmy");
+	checkLayout<CompactArmy>("CompactArmy");
+
+	if (failureCount == 0)
+		std::printf("army layout: all checks passed\n");
+	return failureCount == 0 ? 0 : 1;
+}
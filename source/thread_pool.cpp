@@ -0,0 +1,219 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "hardware_counters.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#endif
+
+
+namespace
+{
+	std::unique_ptr<ThreadPool> instance;
+	thread_local bool isWorkerThread = false;
+}
+
+ThreadPool& ThreadPool::Get()
+{
+	if (!instance)
+		Configure(ThreadPoolConfig());
+
+	return *instance;
+}
+
+void ThreadPool::Configure(const ThreadPoolConfig& config)
+{
+	instance.reset();
+	instance.reset(new ThreadPool(config));
+}
+
+ThreadPool::ThreadPool(const ThreadPoolConfig& config)
+	: config(config)
+{
+	int workerCount = config.workerCount;
+	if (workerCount < 0)
+		workerCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+	for (int i = 0; i < workerCount; ++i)
+		workers.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stop = true;
+	}
+	wake.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void ThreadPool::Run(int taskCount, const std::function<void(int)>& task)
+{
+	if (taskCount <= 0)
+		return;
+
+	if (taskCount == 1 || isWorkerThread || workers.empty())
+	{
+		for (int i = 0; i < taskCount; ++i)
+			task(i);
+		return;
+	}
+
+	Job job;
+	job.task = &task;
+	job.taskCount = taskCount;
+	job.remaining = taskCount;
+	job.counted = HardwareCounters::IsRecordingThread();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(&job);
+	}
+	wake.notify_all();
+
+	RunTasks(job);
+
+	{
+		// Once the job is off the queue no worker can pick it up anymore.
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = std::find(jobs.begin(), jobs.end(), &job);
+		if (it != jobs.end())
+			jobs.erase(it);
+	}
+
+	while (job.remaining.load(std::memory_order_acquire) > 0 || job.activeWorkers.load(std::memory_order_acquire) > 0)
+		std::this_thread::yield();
+}
+
+void ThreadPool::Submit(std::function<void()> task)
+{
+	if (workers.empty())
+	{
+		task();
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		backgroundTasks.push_back(std::move(task));
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::RunTasks(Job& job)
+{
+	for (int i = job.next.fetch_add(1); i < job.taskCount; i = job.next.fetch_add(1))
+	{
+		(*job.task)(i);
+		job.remaining.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+void ThreadPool::WorkerLoop(int workerIndex)
+{
+	isWorkerThread = true;
+	HardwareCounters::RegisterCurrentThread();
+
+	if (config.pinThreads)
+		PinCurrentThread(config.firstCore + 1 + workerIndex);
+
+	while (true)
+	{
+		Job* job = nullptr;
+		std::function<void()> backgroundTask;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return stop || !jobs.empty() || !backgroundTasks.empty(); });
+
+			// Background tasks still queued at shutdown are run, not dropped.
+			if (jobs.empty() && backgroundTasks.empty())
+			{
+				lock.unlock();
+				HardwareCounters::UnregisterCurrentThread();
+				return;
+			}
+
+			if (jobs.empty())
+			{
+				backgroundTask = std::move(backgroundTasks.front());
+				backgroundTasks.pop_front();
+			}
+			else
+			{
+				job = jobs.front();
+				++job->activeWorkers;
+			}
+		}
+
+		if (backgroundTask)
+		{
+			backgroundTask();
+			continue;
+		}
+
+		HardwareCounters::Sample countersBegin;
+		if (job->counted)
+			HardwareCounters::ReadCurrentThread(countersBegin);
+
+		RunTasks(*job);
+
+		if (job->counted)
+		{
+			HardwareCounters::Sample countersEnd;
+			HardwareCounters::ReadCurrentThread(countersEnd);
+			HardwareCounters::AddWorkerWork(countersBegin, countersEnd);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!jobs.empty() && jobs.front() == job)
+				jobs.pop_front();
+		}
+		job->activeWorkers.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+bool ThreadPool::PinCurrentThread(int core)
+{
+	const int coreCount = std::max(1, (int)std::thread::hardware_concurrency());
+	core %= coreCount;
+
+#if defined(_WIN32)
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % 64)) != 0;
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(core, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+bool ThreadPool::SetInterleavedMemory(bool enable)
+{
+#if defined(__linux__)
+	// set_mempolicy without a libnuma dependency; the kernel intersects the mask with the online nodes.
+	const int mpolDefault = 0;
+	const int mpolInterleave = 3;
+	const unsigned long allNodes = ~0ul;
+	if (enable)
+		return syscall(SYS_set_mempolicy, mpolInterleave, &allNodes, sizeof(allNodes) * 8) == 0;
+	return syscall(SYS_set_mempolicy, mpolDefault, nullptr, 0) == 0;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+struct ThreadPoolConfig
+{
+	// Worker threads besides the calling thread; -1 picks hardware_concurrency - 1.
+	int workerCount = -1;
+	// Pin worker i to logical core firstCore + 1 + i, leaving firstCore to the simulation thread.
+	bool pinThreads = false;
+	int firstCore = 0;
+};
+
+/// Owned fork-join pool behind parallelFor/splitParallelFor. The submitting thread
+/// works on its own job too, so a job always finishes even with zero workers.
+/// Several threads may submit at once (simulation and drawing); a job submitted
+/// from inside a worker runs inline on that worker.
+class ThreadPool
+{
+public:
+	static ThreadPool& Get();
+
+	/// Replaces the workers. Must not be called while a job is running.
+	static void Configure(const ThreadPoolConfig& config);
+
+	~ThreadPool();
+
+	/// Workers plus the submitting thread.
+	int GetThreadCount() const { return (int)workers.size() + 1; }
+
+	/// Runs task(i) for every i in [0, taskCount) and returns when all are done.
+	void Run(int taskCount, const std::function<void(int)>& task);
+
+	/// Queues task for a worker and returns immediately. Workers prefer fork-join
+	/// jobs, so background tasks only use otherwise idle threads; parallelFor inside
+	/// a background task runs inline. Without workers the task runs right away.
+	void Submit(std::function<void()> task);
+
+	/// Restricts the calling thread to a single logical core.
+	static bool PinCurrentThread(int core);
+
+	/// Makes memory first touched by the calling thread interleave page by page
+	/// across all NUMA nodes, so buffers swept by workers on every socket are not
+	/// served from a single node. Linux only; returns false where unsupported.
+	static bool SetInterleavedMemory(bool enable);
+
+private:
+	struct Job
+	{
+		const std::function<void(int)>* task;
+		int taskCount;
+		std::atomic<int> next = 0;
+		std::atomic<int> remaining = 0;
+		std::atomic<int> activeWorkers = 0;
+		// Submitted by the hardware counters' recording thread; workers count their share.
+		bool counted = false;
+	};
+
+	explicit ThreadPool(const ThreadPoolConfig& config);
+
+	void WorkerLoop(int workerIndex);
+	static void RunTasks(Job& job);
+
+	ThreadPoolConfig config;
+	std::vector<std::thread> workers;
+	std::deque<Job*> jobs;
+	std::deque<std::function<void()>> backgroundTasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stop = false;
+};
@@ -0,0 +1,158 @@
+#pragma once
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#include "thread_pool.h"
+#include "vector2.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define VECTOR_EXPRESSIONS_SSE
+#include <xmmintrin.h>
+#endif
+
+
+/// Lazy element-wise math over columns such as army positions or province flow.
+/// An expression like
+///
+///     evaluate(indices, output, normalize(column(a)) * column(speed) + column(b));
+///
+/// only records what to compute; evaluate then runs it in one parallel pass
+/// that reads each input element once and writes the output once, with no
+/// intermediate buffers between the steps. The output may be one of the inputs.
+namespace VectorExpressions
+{
+	/// 1 / sqrt(x) from the hardware estimate refined by one Newton-Raphson step,
+	/// about 23 bits exact. x must be positive and normal: the estimate of a
+	/// denormal is infinite.
+	inline float reciprocalSqrt(float x)
+	{
+#if defined(VECTOR_EXPRESSIONS_SSE)
+		const float estimate = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+		return estimate * (1.5f - 0.5f * x * estimate * estimate);
+#else
+		return 1.0f / std::sqrt(x);
+#endif
+	}
+
+	/// Same as Vector2::SafeNormalize, without the square root and division.
+	/// Vectors too short to square into a normal float normalize to zero.
+	inline ShallowTest::Vector2 fastNormalize(const ShallowTest::Vector2& v)
+	{
+		const float lengthSquared = v.x * v.x + v.y * v.y;
+		if (lengthSquared < FLT_MIN)
+			return ShallowTest::Vector2(0.0f, 0.0f);
+		return v * reciprocalSqrt(lengthSquared);
+	}
+
+	template<class Derived>
+	struct Expression
+	{
+		const Derived& self() const { return static_cast<const Derived&>(*this); }
+	};
+
+	template<class Container>
+	struct Column : Expression<Column<Container>>
+	{
+		explicit Column(const Container& values) : values(values) {}
+		auto operator[](int i) const { return values[i]; }
+
+		const Container& values;
+	};
+
+	template<class T>
+	struct Scalar : Expression<Scalar<T>>
+	{
+		explicit Scalar(T value) : value(value) {}
+		T operator[](int) const { return value; }
+
+		T value;
+	};
+
+	struct Add
+	{
+		template<class A, class B>
+		static auto Apply(const A& a, const B& b) { return a + b; }
+	};
+
+	struct Subtract
+	{
+		template<class A, class B>
+		static auto Apply(const A& a, const B& b) { return a - b; }
+	};
+
+	struct Multiply
+	{
+		template<class A, class B>
+		static auto Apply(const A& a, const B& b) { return a * b; }
+		static ShallowTest::Vector2 Apply(float a, const ShallowTest::Vector2& b) { return b * a; }
+	};
+
+	template<class Operation, class Left, class Right>
+	struct Binary : Expression<Binary<Operation, Left, Right>>
+	{
+		Binary(const Left& left, const Right& right) : left(left), right(right) {}
+		auto operator[](int i) const { return Operation::Apply(left[i], right[i]); }
+
+		Left left;
+		Right right;
+	};
+
+	template<class Inner>
+	struct Normalized : Expression<Normalized<Inner>>
+	{
+		explicit Normalized(const Inner& inner) : inner(inner) {}
+		ShallowTest::Vector2 operator[](int i) const { return fastNormalize(inner[i]); }
+
+		Inner inner;
+	};
+
+	/// Reads values[i]; the container must outlive the expression.
+	template<class Container>
+	Column<Container> column(const Container& values) { return Column<Container>(values); }
+
+	template<class Inner>
+	Normalized<Inner> normalize(const Expression<Inner>& inner) { return Normalized<Inner>(inner.self()); }
+
+	template<class Left, class Right>
+	Binary<Add, Left, Right> operator+(const Expression<Left>& left, const Expression<Right>& right) { return { left.self(), right.self() }; }
+
+	template<class Left, class Right>
+	Binary<Subtract, Left, Right> operator-(const Expression<Left>& left, const Expression<Right>& right) { return { left.self(), right.self() }; }
+
+	template<class Left, class Right>
+	Binary<Multiply, Left, Right> operator*(const Expression<Left>& left, const Expression<Right>& right) { return { left.self(), right.self() }; }
+
+	template<class Left>
+	Binary<Multiply, Left, Scalar<float>> operator*(const Expression<Left>& left, float right) { return { left.self(), Scalar<float>(right) }; }
+
+	template<class Right>
+	Binary<Multiply, Scalar<float>, Right> operator*(float left, const Expression<Right>& right) { return { Scalar<float>(left), right.self() }; }
+
+	template<class Left>
+	Binary<Add, Left, Scalar<ShallowTest::Vector2>> operator+(const Expression<Left>& left, const ShallowTest::Vector2& right) { return { left.self(), Scalar<ShallowTest::Vector2>(right) }; }
+
+	/// output[i] = expression[i] for every i in indices, in one pass split over the pool threads.
+	template<class Output, class Derived>
+	void evaluate(const std::vector<int>& indices, Output& output, const Expression<Derived>& expression)
+	{
+		const Derived& e = expression.self();
+		const int size = (int)indices.size();
+		if (size == 0)
+			return;
+
+		ThreadPool& pool = ThreadPool::Get();
+		const int taskCount = std::min(size, pool.GetThreadCount() * 4);
+		pool.Run(taskCount, [&](int task)
+			{
+				const int begin = (int)((long long)size * task / taskCount);
+				const int end = (int)((long long)size * (task + 1) / taskCount);
+				for (int k = begin; k < end; ++k)
+				{
+					const int i = indices[k];
+					output[i] = e[i];
+				}
+			});
+	}
+}